@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 
 #include "alloc.hpp"
 #include "error.hpp"
@@ -52,6 +53,126 @@ GLuint GLRef::operator*(void) const
 GLObj::GLObj(GLDeleter d): deleter(d), refCount(0), handle(0)
 {
 }
+GLState::GLState(void)
+: program(0), vertexArray(0), depthMask(GL_TRUE),
+  knowsProgram(false), knowsVertexArray(false), knowsDepthMask(false)
+{
+}
+void GLState::UseProgram(const GLuint p)
+{
+    if (knowsProgram && program == p)
+        return;
+
+    glUseProgram(p);
+    CHECK_GL();
+
+    program = p;
+    knowsProgram = true;
+}
+void GLState::BindVertexArray(const GLuint v)
+{
+    if (knowsVertexArray && vertexArray == v)
+        return;
+
+    glBindVertexArray(v);
+    CHECK_GL();
+
+    vertexArray = v;
+    knowsVertexArray = true;
+
+    // The element array binding belongs to the vertex array.
+    mBuffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+}
+void GLState::BindBuffer(const GLenum target, const GLuint buffer)
+{
+    if (mBuffers.find(target) != mBuffers.end() && mBuffers.at(target) == buffer)
+        return;
+
+    glBindBuffer(target, buffer);
+    CHECK_GL();
+
+    mBuffers[target] = buffer;
+}
+void GLState::BindBufferBase(const GLenum target, const GLuint index, const GLuint buffer)
+{
+    // Always a call, but it binds to the generic target too.
+    glBindBufferBase(target, index, buffer);
+    CHECK_GL();
+
+    mBuffers[target] = buffer;
+}
+void GLState::Enable(const GLenum capability)
+{
+    if (mCapabilities.find(capability) != mCapabilities.end() && mCapabilities.at(capability))
+        return;
+
+    glEnable(capability);
+    CHECK_GL();
+
+    mCapabilities[capability] = GL_TRUE;
+}
+void GLState::Disable(const GLenum capability)
+{
+    if (mCapabilities.find(capability) != mCapabilities.end() && !mCapabilities.at(capability))
+        return;
+
+    glDisable(capability);
+    CHECK_GL();
+
+    mCapabilities[capability] = GL_FALSE;
+}
+GLboolean GLState::IsEnabled(const GLenum capability)
+{
+    if (mCapabilities.find(capability) == mCapabilities.end())
+    {
+        mCapabilities[capability] = glIsEnabled(capability);
+        CHECK_GL();
+    }
+
+    return mCapabilities.at(capability);
+}
+void GLState::DepthMask(const GLboolean mask)
+{
+    if (knowsDepthMask && depthMask == mask)
+        return;
+
+    glDepthMask(mask);
+    CHECK_GL();
+
+    depthMask = mask;
+    knowsDepthMask = true;
+}
+void GLState::Invalidate(void)
+{
+    knowsProgram = false;
+    knowsVertexArray = false;
+    knowsDepthMask = false;
+    mBuffers.clear();
+    mCapabilities.clear();
+}
+void GLState::ForgetProgram(const GLuint p)
+{
+    if (program == p)
+        knowsProgram = false;
+}
+void GLState::ForgetVertexArray(const GLuint v)
+{
+    if (vertexArray == v)
+        knowsVertexArray = false;
+
+    mBuffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+}
+void GLState::ForgetBuffer(const GLuint buffer)
+{
+    auto it = mBuffers.begin();
+    while (it != mBuffers.end())
+    {
+        if (it->second == buffer)
+            it = mBuffers.erase(it);
+        else
+            it++;
+    }
+}
 GLManager::GLManager()
 {
 }
@@ -73,7 +194,7 @@ GLRef GLManager::AllocTexture(void)
 }
 GLRef GLManager::AllocShaderProgram(void)
 {
-    GLObj *pObj = AddObj([](GLuint program) { glDeleteProgram(program); CHECK_GL(); });
+    GLObj *pObj = AddObj([this](GLuint program) { mState.ForgetProgram(program); glDeleteProgram(program); CHECK_GL(); });
     pObj->handle = glCreateProgram();
     CHECK_GL();
 
@@ -84,7 +205,7 @@ GLRef GLManager::AllocShaderProgram(void)
 }
 GLRef GLManager::AllocBuffer(void)
 {
-    GLObj *pObj = AddObj([](GLuint buffer) { glDeleteBuffers(1, &buffer); CHECK_GL(); });
+    GLObj *pObj = AddObj([this](GLuint buffer) { mState.ForgetBuffer(buffer); glDeleteBuffers(1, &buffer); CHECK_GL(); });
     glGenBuffers(1, &(pObj->handle));
     CHECK_GL();
 
@@ -104,6 +225,28 @@ GLRef GLManager::AllocFrameBuffer(void)
 
     return GLRef(pObj);
 }
+GLRef GLManager::AllocVertexArray(void)
+{
+    GLObj *pObj = AddObj([this](GLuint vertexArray) { mState.ForgetVertexArray(vertexArray); glDeleteVertexArrays(1, &vertexArray); CHECK_GL(); });
+    glGenVertexArrays(1, &(pObj->handle));
+    CHECK_GL();
+
+    if (pObj->handle == 0)
+        throw GLError("No vertex array was allocated.");
+
+    return GLRef(pObj);
+}
+GLRef GLManager::AllocQuery(void)
+{
+    GLObj *pObj = AddObj([](GLuint query) { glDeleteQueries(1, &query); CHECK_GL(); });
+    glGenQueries(1, &(pObj->handle));
+    CHECK_GL();
+
+    if (pObj->handle == 0)
+        throw GLError("No query was allocated.");
+
+    return GLRef(pObj);
+}
 void GLManager::GarbageCollect(void)
 {
     auto it = mObjs.begin();
@@ -118,6 +261,10 @@ void GLManager::GarbageCollect(void)
             it++;
     }
 }
+GLState *GLManager::GetState(void)
+{
+    return &mState;
+}
 void GLManager::DestroyAll(void)
 {
     for (GLObj &obj : mObjs)
@@ -126,6 +273,84 @@ void GLManager::DestroyAll(void)
     }
     mObjs.clear();
 }
+void ShaderProgram::Alloc(void)
+{
+    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
+
+    mUniformLocations.clear();
+    mAttributeLocations.clear();
+}
+GLuint ShaderProgram::operator*(void) const
+{
+    return *pProgram;
+}
+void ShaderProgram::Reflect(void)
+{
+    GLint count, maxLength, i, size;
+    GLenum type;
+
+    mUniformLocations.clear();
+    mAttributeLocations.clear();
+
+    glGetProgramiv(*pProgram, GL_ACTIVE_UNIFORMS, &count);
+    CHECK_GL();
+    glGetProgramiv(*pProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    CHECK_GL();
+
+    std::unique_ptr<char[]> name(new char[maxLength + 1]);
+    for (i = 0; i < count; i++)
+    {
+        glGetActiveUniform(*pProgram, i, maxLength + 1, NULL, &size, &type, name.get());
+        CHECK_GL();
+
+        std::string uniformName(name.get());
+        GLint location = glGetUniformLocation(*pProgram, uniformName.c_str());
+        CHECK_GL();
+
+        // Uniforms in blocks have no location.
+        if (location < 0)
+            continue;
+
+        mUniformLocations[uniformName] = location;
+
+        // Arrays are reported as "name[0]", but "name" means the same.
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+            mUniformLocations[uniformName.substr(0, uniformName.size() - 3)] = location;
+    }
+
+    glGetProgramiv(*pProgram, GL_ACTIVE_ATTRIBUTES, &count);
+    CHECK_GL();
+    glGetProgramiv(*pProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    CHECK_GL();
+
+    name.reset(new char[maxLength + 1]);
+    for (i = 0; i < count; i++)
+    {
+        glGetActiveAttrib(*pProgram, i, maxLength + 1, NULL, &size, &type, name.get());
+        CHECK_GL();
+
+        mAttributeLocations[name.get()] = glGetAttribLocation(*pProgram, name.get());
+        CHECK_GL();
+    }
+}
+GLint ShaderProgram::GetUniformLocation(const std::string &name) const
+{
+    if (mUniformLocations.find(name) == mUniformLocations.end())
+        throw GLError("No active uniform %s", name.c_str());
+
+    return mUniformLocations.at(name);
+}
+GLint ShaderProgram::GetAttributeLocation(const std::string &name) const
+{
+    if (mAttributeLocations.find(name) == mAttributeLocations.end())
+        throw GLError("No active attribute %s", name.c_str());
+
+    return mAttributeLocations.at(name);
+}
+void ShaderProgram::Use(void) const
+{
+    App::Instance().GetGLState()->UseProgram(*pProgram);
+}
 GLScoped::GLScoped(GLuint h, GLDeleter d): handle(h), deleter(d)
 {
 }
@@ -137,3 +362,159 @@ GLuint GLScoped::operator*(void) const
 {
     return handle;
 }
+StagingBuffer::StagingBuffer(void)
+: pMapped(NULL), slotSize(0)
+{
+}
+#define STAGING_SLOT_ALIGNMENT 256
+bool StagingBuffer::Init(const size_t size, const size_t countSlots)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    if (!GLEW_ARB_buffer_storage)
+        return false;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    slotSize = ((size + STAGING_SLOT_ALIGNMENT - 1) / STAGING_SLOT_ALIGNMENT) * STAGING_SLOT_ALIGNMENT;
+
+    pBuffer = App::Instance().GetGLManager()->AllocBuffer();
+
+    pState->BindBuffer(GL_COPY_READ_BUFFER, *pBuffer);
+
+    glBufferStorage(GL_COPY_READ_BUFFER, slotSize * countSlots, NULL, flags);
+    CHECK_GL();
+
+    pMapped = (char *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, slotSize * countSlots, flags);
+    CHECK_GL();
+
+    pState->BindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (pMapped == NULL)
+        throw GLError("Cannot map staging buffer");
+
+    std::scoped_lock lock(mtxSlots);
+
+    size_t i;
+    for (i = 0; i < countSlots; i++)
+        mFreeSlots.push_back(i);
+
+    return true;
+}
+bool StagingBuffer::Acquire(size_t &slot, void *&pData)
+{
+    std::scoped_lock lock(mtxSlots);
+
+    if (mFreeSlots.size() <= 0)
+        return false;
+
+    slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+
+    pData = pMapped + slot * slotSize;
+
+    return true;
+}
+void StagingBuffer::CopyTo(const size_t slot, const GLuint buffer, const GLintptr offset, const size_t size)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    pState->BindBuffer(GL_COPY_READ_BUFFER, *pBuffer);
+
+    pState->BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot * slotSize, offset, size);
+    CHECK_GL();
+
+    pState->BindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    pState->BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // The slot may not be overwritten before the GPU has executed the copy.
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    CHECK_GL();
+
+    mFencedSlots.emplace_back(slot, fence);
+}
+void StagingBuffer::CopyToTexture(const size_t slot, const GLuint texture,
+                                  const GLint y, const GLsizei width, const GLsizei height, const GLenum format)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    pState->BindBuffer(GL_PIXEL_UNPACK_BUFFER, *pBuffer);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    CHECK_GL();
+
+    // Rows are tightly packed.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    CHECK_GL();
+
+    // With a pixel unpack buffer bound, the pointer is an offset in it.
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, height, format, GL_UNSIGNED_BYTE, (const GLvoid *)(slot * slotSize));
+    CHECK_GL();
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    CHECK_GL();
+
+    pState->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    CHECK_GL();
+
+    mFencedSlots.emplace_back(slot, fence);
+}
+void StagingBuffer::Release(const size_t slot)
+{
+    std::scoped_lock lock(mtxSlots);
+
+    // After Free, there's nothing to give it back to.
+    if (pMapped != NULL)
+        mFreeSlots.push_back(slot);
+}
+size_t StagingBuffer::GetSlotSize(void) const
+{
+    return slotSize;
+}
+void StagingBuffer::Free(void)
+{
+    for (auto &pair : mFencedSlots)
+    {
+        glDeleteSync(pair.second);
+        CHECK_GL();
+    }
+    mFencedSlots.clear();
+
+    std::scoped_lock lock(mtxSlots);
+    mFreeSlots.clear();
+
+    // The GL manager deletes the buffer, which also unmaps it.
+    pBuffer = GLRef();
+    pMapped = NULL;
+}
+void StagingBuffer::Recycle(void)
+{
+    GLenum result;
+
+    auto it = mFencedSlots.begin();
+    while (it != mFencedSlots.end())
+    {
+        result = glClientWaitSync(it->second, 0, 0);
+        CHECK_GL();
+
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+        {
+            glDeleteSync(it->second);
+            CHECK_GL();
+
+            {
+                std::scoped_lock lock(mtxSlots);
+                mFreeSlots.push_back(it->first);
+            }
+
+            it = mFencedSlots.erase(it);
+        }
+        else
+            it++;
+    }
+}
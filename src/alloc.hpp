@@ -3,6 +3,10 @@
 
 #include <functional>
 #include <list>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -52,11 +56,48 @@ class GLRef
 class App;
 
 
+/**
+ *  Remembers what's bound and enabled, so that calls that wouldn't change anything can be skipped.
+ *  Only works if all binding goes through here. GL thread only.
+ */
+class GLState
+{
+    private:
+        GLuint program,
+               vertexArray;
+        std::unordered_map<GLenum, GLuint> mBuffers;
+        std::unordered_map<GLenum, GLboolean> mCapabilities;
+        GLboolean depthMask;
+        bool knowsProgram, knowsVertexArray, knowsDepthMask;
+    public:
+        GLState(void);
+
+        void UseProgram(const GLuint);
+        void BindVertexArray(const GLuint);
+        void BindBuffer(const GLenum target, const GLuint);
+        void BindBufferBase(const GLenum target, const GLuint index, const GLuint);
+        void Enable(const GLenum capability);
+        void Disable(const GLenum capability);
+        GLboolean IsEnabled(const GLenum capability);
+        void DepthMask(const GLboolean);
+
+        // For when the state might have been changed behind its back.
+        void Invalidate(void);
+
+        // Deleted objects are unbound by the GL, their names may be reused.
+        void ForgetProgram(const GLuint);
+        void ForgetVertexArray(const GLuint);
+        void ForgetBuffer(const GLuint);
+};
+
+
 class GLManager
 {
     private:
         std::list<GLObj> mObjs;
 
+        GLState mState;
+
         GLObj *AddObj(GLDeleter);
     public:
         GLManager();
@@ -65,14 +106,48 @@ class GLManager
         GLRef AllocShaderProgram(void);
         GLRef AllocBuffer(void);
         GLRef AllocFrameBuffer(void);
+        GLRef AllocVertexArray(void);
+        GLRef AllocQuery(void);
 
         void GarbageCollect(void);
         void DestroyAll(void);
 
+        GLState *GetState(void);
+
     friend class GLRef;
 };
 
 
+/**
+ *  A shader program that knows the locations of its active uniforms and attributes.
+ *  They're looked up once, after linking, so that rendering doesn't need to.
+ */
+class ShaderProgram
+{
+    private:
+        GLRef pProgram;
+
+        std::unordered_map<std::string, GLint> mUniformLocations,
+                                               mAttributeLocations;
+
+        void Reflect(void);
+    public:
+        // GL thread.
+        void Alloc(void);
+
+        GLuint operator*(void) const;
+
+        // Throw a GLError if not active.
+        GLint GetUniformLocation(const std::string &name) const;
+        GLint GetAttributeLocation(const std::string &name) const;
+
+        // Skips the call if the program is in use already.
+        void Use(void) const;
+
+    friend class ShaderLoadJob;
+};
+
+
 class GLScoped
 {
     private:
@@ -89,4 +164,52 @@ class GLScoped
 };
 
 
+/**
+ *  A persistently mapped buffer (ARB_buffer_storage), divided in equally sized slots.
+ *  Any thread may fill a slot. The GL thread then copies it into another buffer,
+ *  after which the slot is reused once the GPU is done with it.
+ */
+class StagingBuffer
+{
+    private:
+        GLRef pBuffer;
+        char *pMapped;
+        size_t slotSize;
+
+        std::mutex mtxSlots;
+        std::vector<size_t> mFreeSlots;
+
+        // GL thread only.
+        std::list<std::pair<size_t, GLsync>> mFencedSlots;
+
+        StagingBuffer(const StagingBuffer &) = delete;
+        void operator=(const StagingBuffer &) = delete;
+    public:
+        StagingBuffer(void);
+
+        // GL thread. Returns false if persistent mapping is not supported.
+        bool Init(const size_t slotSize, const size_t countSlots);
+
+        // Any thread. Returns false if no slot is free.
+        bool Acquire(size_t &slot, void *&pData);
+
+        // GL thread. Copies size bytes from the slot and releases it.
+        void CopyTo(const size_t slot, const GLuint buffer, const GLintptr offset, const size_t size);
+
+        // GL thread. Unpacks pixels from the slot into rows of a texture and releases the slot.
+        void CopyToTexture(const size_t slot, const GLuint texture,
+                           const GLint y, const GLsizei width, const GLsizei height, const GLenum format);
+
+        // Any thread. Gives back a slot that was acquired, but never copied from.
+        void Release(const size_t slot);
+
+        size_t GetSlotSize(void) const;
+
+        // GL thread. Must be called before the GL manager destroys all.
+        void Free(void);
+
+        // GL thread. Frees the slots that the GPU is done copying from.
+        void Recycle(void);
+};
+
 #endif  // ALLOC_HPP
@@ -5,6 +5,7 @@
 #include "app.hpp"
 #include "load.hpp"
 #include "game.hpp"
+#include "texture.hpp"
 
 
 App &App::Instance(void)
@@ -14,7 +15,7 @@ App &App::Instance(void)
 }
 App::App(void)
 : mMainGLContext(NULL), mMainWindow(NULL), running(false),
-  pCurrentScene(NULL)
+  pCurrentScene(NULL), countDeferredGL(0), textureStaging(false)
 {
 }
 App::~App(void)
@@ -22,6 +23,7 @@ App::~App(void)
     if (HasSystem())
     {
         mFontManager.DestroyAll();
+        mTextureStagingBuffer.Free();
         mGLManager.DestroyAll();
         SystemFree();
     }
@@ -39,6 +41,8 @@ void App::GetConfig(Config &config)
     config.resolution.height = 600;
 
     config.render.distance = 1000.0f;
+    config.render.uploadMillis = 4.0;
+    config.render.uploadBytes = 8 * 1024 * 1024;
 
     config.controls[KEYB_JUMP] = SDLK_SPACE;
     config.controls[KEYB_DUCK] = SDLK_LSHIFT;
@@ -51,14 +55,44 @@ GLManager *App::GetGLManager(void)
 {
     return &mGLManager;
 }
+GLState *App::GetGLState(void)
+{
+    return mGLManager.GetState();
+}
 FontManager *App::GetFontManager(void)
 {
     return &mFontManager;
 }
+StagingBuffer *App::GetTextureStagingBuffer(void)
+{
+    return textureStaging ? &mTextureStagingBuffer : NULL;
+}
 boost::filesystem::path App::GetResourcePath(const std::string &location) const
 {
     return exePath.parent_path() / "resources" / location;
 }
+boost::filesystem::path GetArchivePath(const boost::filesystem::path &exePath)
+{
+    return exePath.parent_path() / "resources.pak";
+}
+std::shared_ptr<const Resource> App::OpenResource(const std::string &location) const
+{
+    if (pArchive != NULL && pArchive->Has(location))
+        return pArchive->Open(location);
+
+    return std::make_shared<MappedFile>(GetResourcePath(location));
+}
+bool App::GetResourceWriteTime(const std::string &location, std::time_t &t) const
+{
+    boost::system::error_code ec;
+
+    if (pArchive != NULL && pArchive->Has(location))
+        t = boost::filesystem::last_write_time(GetArchivePath(exePath), ec);
+    else
+        t = boost::filesystem::last_write_time(GetResourcePath(location), ec);
+
+    return !ec;
+}
 bool App::HasSystem(void)
 {
     return mMainGLContext != NULL;
@@ -135,6 +169,13 @@ void App::SystemInit(void)
     {
         throw InitError("OpenGL version 3.2 is not enabled.");
     }
+
+    // Let the driver choose how many threads compile shaders.
+    if (GLEW_KHR_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsKHR(0xffffffff);
+        CHECK_GL();
+    }
 }
 void App::SwitchScene(Scene *p)
 {
@@ -149,16 +190,36 @@ void App::SwitchScene(Scene *p)
 }
 void App::PushGL(Job *p)
 {
-    mGLQueue.Add(p);
+    // The GL thread can't wait for itself to empty the queue.
+    if (std::this_thread::get_id() == glThreadID)
+        mGLJobRunner.Add(std::unique_ptr<Job>(p));
+    else
+        mGLQueue.Add(p);
+}
+size_t App::CountPendingGL(void)
+{
+    return mGLQueue.Size() + mGLJobRunner.CountPending();
+}
+size_t App::CountDeferredGL(void)
+{
+    return countDeferredGL;
 }
 void App::Run(void)
 {
     SDL_Event event;
+    Config config;
 
     if (!HasSystem())
         SystemInit();
 
-    mFontManager.InitAll(GetResourcePath("tiki.svg"));
+    glThreadID = std::this_thread::get_id();
+
+    // Without an archive, the loose files are used.
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(GetArchivePath(exePath), ec))
+        pArchive = std::make_unique<Archive>(GetArchivePath(exePath));
+
+    textureStaging = mTextureStagingBuffer.Init(TEXTURE_STAGING_SLOT_SIZE, COUNT_TEXTURE_STAGING_SLOTS);
 
     // Scene scope.
     InGameScene gameScene;
@@ -171,13 +232,21 @@ void App::Run(void)
         while (SDL_PollEvent(&event))
             OnEvent(event);
 
-        WorkAllFrom(mGLQueue);
+        // Don't let a burst of GL jobs make the frame stutter.
+        GetConfig(config);
+        countDeferredGL = mGLJobRunner.WorkFrom(mGLQueue, config.render.uploadMillis, config.render.uploadBytes);
+
+        if (textureStaging)
+            mTextureStagingBuffer.Recycle();
 
         // In this scope, we lock the current scene.
         {
             std::scoped_lock lock(mtxCurrentScene);
             pCurrentScene->Update();
 
+            // Libraries may have changed it.
+            mGLManager.GetState()->Invalidate();
+
             // In this scope, we lock the GL context for rendering.
             pCurrentScene->Render();
             SDL_GL_SwapWindow(mMainWindow);
@@ -186,6 +255,10 @@ void App::Run(void)
 
     // Let the current scene Know that it's ending.
     SwitchScene(NULL);
+
+    // The jobs that didn't run may point into the scenes, so delete them while those still exist.
+    ClearAllFrom(mGLQueue);
+    mGLJobRunner.Clear();
 }
 void App::OnEvent(const SDL_Event &event)
 {
@@ -210,21 +283,3 @@ bool App::IsRunning(void)
 {
     return running;
 }
-
-int main(int argc, char **argv)
-{
-    App::Instance().exePath = argv[0];
-
-    try
-    {
-        App::Instance().Run();
-
-        return 0;
-    }
-    catch (const std::exception &e)
-    {
-        std::cerr << e.what() << std::endl;
-
-        return 1;
-    }
-};
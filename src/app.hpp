@@ -2,7 +2,10 @@
 #define APP_HPP
 
 #include <mutex>
+#include <thread>
 #include <atomic>
+#include <memory>
+#include <ctime>
 
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
@@ -15,6 +18,8 @@
 #include "alloc.hpp"
 #include "text.hpp"
 #include "load.hpp"
+#include "resource.hpp"
+#include "archive.hpp"
 
 
 class GLLock;
@@ -23,6 +28,7 @@ class App: public EventListener
 {
     private:
         boost::filesystem::path exePath;
+        std::unique_ptr<Archive> pArchive;  // NULL if the resources are loose files
 
         std::recursive_mutex mtxConfig;
         Config mConfig;
@@ -37,8 +43,14 @@ class App: public EventListener
 
         GLManager mGLManager;
         Queue mGLQueue;
+        BudgetedJobRunner mGLJobRunner;
+        std::thread::id glThreadID;
+        std::atomic<size_t> countDeferredGL;
         FontManager mFontManager;
 
+        StagingBuffer mTextureStagingBuffer;
+        bool textureStaging;
+
         bool HasSystem(void);
         void SystemInit(void);
         void SystemFree(void);
@@ -58,11 +70,27 @@ class App: public EventListener
         void GetConfig(Config &);
 
         GLManager *GetGLManager(void);
+        GLState *GetGLState(void);
         FontManager *GetFontManager(void);
 
+        // NULL if persistent mapping isn't supported.
+        StagingBuffer *GetTextureStagingBuffer(void);
+
         boost::filesystem::path GetResourcePath(const std::string &location) const;
 
+        /**
+         *  Takes the resource from the archive if it's in there,
+         *  else maps the file at the resource path in memory. Any thread.
+         */
+        std::shared_ptr<const Resource> OpenResource(const std::string &location) const;
+
+        // Of the archive, for packed resources. Returns false if unknown.
+        bool GetResourceWriteTime(const std::string &location, std::time_t &) const;
+
+        // Any thread, including the GL thread itself.
         void PushGL(Job *);
+        size_t CountPendingGL(void);
+        size_t CountDeferredGL(void);  // at the last frame
 
         void SwitchScene(Scene *);
 
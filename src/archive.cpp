@@ -0,0 +1,166 @@
+#include <cstring>
+#include <vector>
+
+#include <lz4.h>
+
+#include "archive.hpp"
+#include "error.hpp"
+
+
+uint64_t HashBytes(const char *pData, const size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (uint8_t)pData[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Points into the archive and keeps it mapped.
+class ArchiveSpan: public Resource
+{
+    private:
+        std::shared_ptr<const MappedFile> pFile;
+        const char *pData;
+        size_t size;
+    public:
+        ArchiveSpan(std::shared_ptr<const MappedFile> p, const size_t offset, const size_t s)
+        : pFile(p), pData(p->GetData() + offset), size(s)
+        {
+        }
+
+        const char *GetData(void) const
+        {
+            return pData;
+        }
+        size_t GetSize(void) const
+        {
+            return size;
+        }
+};
+
+class DecompressedEntry: public Resource
+{
+    private:
+        std::vector<char> mData;
+    public:
+        DecompressedEntry(const size_t size)
+        : mData(size)
+        {
+        }
+
+        char *GetBuffer(void)
+        {
+            return mData.data();
+        }
+
+        const char *GetData(void) const
+        {
+            return mData.data();
+        }
+        size_t GetSize(void) const
+        {
+            return mData.size();
+        }
+};
+
+// Reads the index without caring about alignment.
+struct ArchiveIndexCursor
+{
+    const char *pData;
+    size_t remaining;
+
+    template <typename T>
+    T Read(void)
+    {
+        T value;
+        if (remaining < sizeof(T))
+            throw FormatError("archive index is truncated");
+
+        memcpy(&value, pData, sizeof(T));
+        pData += sizeof(T);
+        remaining -= sizeof(T);
+        return value;
+    }
+
+    std::string ReadString(const size_t length)
+    {
+        if (remaining < length)
+            throw FormatError("archive index is truncated");
+
+        std::string s(pData, length);
+        pData += length;
+        remaining -= length;
+        return s;
+    }
+};
+
+Archive::Archive(const boost::filesystem::path &path)
+: pFile(std::make_shared<MappedFile>(path))
+{
+    ArchiveHeader header;
+    if (pFile->GetSize() < sizeof(header))
+        throw FormatError("%s is too small for an archive", path.string().c_str());
+
+    memcpy(&header, pFile->GetData(), sizeof(header));
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0)
+        throw FormatError("%s is not an archive", path.string().c_str());
+    else if (header.version != ARCHIVE_VERSION)
+        throw FormatError("%s has archive version %u", path.string().c_str(), header.version);
+    else if (header.indexSize > pFile->GetSize() - sizeof(header))
+        throw FormatError("%s has a truncated index", path.string().c_str());
+
+    ArchiveIndexCursor cursor;
+    cursor.pData = pFile->GetData() + sizeof(header);
+    cursor.remaining = header.indexSize;
+
+    uint32_t i;
+    for (i = 0; i < header.countEntries; i++)
+    {
+        std::string location = cursor.ReadString(cursor.Read<uint16_t>());
+
+        ArchiveEntry entry;
+        entry.offset = cursor.Read<uint64_t>();
+        entry.storedSize = cursor.Read<uint64_t>();
+        entry.size = cursor.Read<uint64_t>();
+        entry.hash = cursor.Read<uint64_t>();
+        entry.compression = cursor.Read<uint32_t>();
+
+        if (entry.offset > pFile->GetSize() || entry.storedSize > pFile->GetSize() - entry.offset)
+            throw FormatError("%s: %s is out of bounds", path.string().c_str(), location.c_str());
+        else if (entry.compression != ARCHIVE_COMPRESSION_NONE && entry.compression != ARCHIVE_COMPRESSION_LZ4)
+            throw FormatError("%s: %s has unknown compression %u", path.string().c_str(), location.c_str(), entry.compression);
+
+        mEntries.emplace(location, entry);
+    }
+}
+bool Archive::Has(const std::string &location) const
+{
+    return mEntries.find(location) != mEntries.end();
+}
+std::shared_ptr<const Resource> Archive::Open(const std::string &location) const
+{
+    auto it = mEntries.find(location);
+    if (it == mEntries.end())
+        throw IOError("No %s in the archive", location.c_str());
+
+    const ArchiveEntry &entry = std::get<1>(*it);
+
+    if (entry.compression == ARCHIVE_COMPRESSION_NONE)
+        return std::make_shared<ArchiveSpan>(pFile, entry.offset, entry.storedSize);
+
+    std::shared_ptr<DecompressedEntry> pEntry = std::make_shared<DecompressedEntry>(entry.size);
+
+    int result = LZ4_decompress_safe(pFile->GetData() + entry.offset, pEntry->GetBuffer(),
+                                     entry.storedSize, entry.size);
+    if (result < 0 || size_t(result) != entry.size)
+        throw FormatError("Cannot decompress %s from the archive", location.c_str());
+
+    // Only checked here, stored entries shouldn't cost a pass over their data.
+    if (HashBytes(pEntry->GetData(), pEntry->GetSize()) != entry.hash)
+        throw FormatError("%s is corrupt in the archive", location.c_str());
+
+    return pEntry;
+}
@@ -0,0 +1,73 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+#include "resource.hpp"
+
+
+/*
+ *  A pack file starts with the header, followed by the index and then the entries' data.
+ *  Every entry in the index is:
+ *      uint16_t nameLength, char name[nameLength],
+ *      uint64_t offset, storedSize, size, hash,
+ *      uint32_t compression
+ *  All numbers are little endian. Offsets are from the start of the file.
+ */
+#define ARCHIVE_MAGIC "TPAK"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ALIGNMENT 16  // of the entries' data
+
+#define ARCHIVE_COMPRESSION_NONE 0
+#define ARCHIVE_COMPRESSION_LZ4 1
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version,
+             countEntries,
+             indexSize;  // in bytes
+};
+
+struct ArchiveEntry
+{
+    uint64_t offset,
+             storedSize,  // in the archive
+             size,  // when decompressed
+             hash;  // of the decompressed data
+    uint32_t compression;
+};
+
+// FNV-1a, 64 bits.
+uint64_t HashBytes(const char *pData, const size_t size);
+
+
+/**
+ *  Many resources in one mapped file, so that there's only one file to open.
+ *  Any thread may open entries, once the archive is constructed.
+ */
+class Archive
+{
+    private:
+        std::shared_ptr<const MappedFile> pFile;
+
+        std::unordered_map<std::string, ArchiveEntry> mEntries;  // by location
+    public:
+        // Throws IOError or FormatError.
+        Archive(const boost::filesystem::path &);
+
+        bool Has(const std::string &location) const;
+
+        /**
+         *  Stored entries are returned without copying, they keep the archive mapped.
+         *  Compressed entries are decompressed on the calling thread.
+         */
+        std::shared_ptr<const Resource> Open(const std::string &location) const;
+};
+
+#endif  // ARCHIVE_HPP
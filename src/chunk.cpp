@@ -30,8 +30,46 @@ ChunkID GetChunkID(const float x, const float z)
 }
 std::tuple<float, float> GetChunkCenter(const ChunkID id)
 {
-    return std::make_tuple((float(id.x) * 0.5f) * CHUNK_SIZE,
-                           (float(id.z) * 0.5f) * CHUNK_SIZE);
+    return std::make_tuple((float(id.x) + 0.5f) * CHUNK_SIZE,
+                           (float(id.z) + 0.5f) * CHUNK_SIZE);
+}
+vec3 ChunkObserver::GetViewDirection(void) const
+{
+    return vec3(0.0f, 0.0f, 0.0f);
+}
+vec3 ChunkObserver::GetVelocity(void) const
+{
+    return vec3(0.0f, 0.0f, 0.0f);
+}
+// How many seconds ahead to predict where the observer is going.
+#define CHUNK_PREDICTION_TIME 1.0f
+// Chunks right behind the observer seem this many times further away.
+#define CHUNK_BEHIND_PRIORITY_FACTOR 4.0f
+float ChunkWorker::GetPriority(const ChunkID id, const ChunkObserver *pObserver) const
+{
+    float cx, cz, distance, cosAngle;
+
+    vec3 predicted = pObserver->GetWorldPosition() + CHUNK_PREDICTION_TIME * pObserver->GetVelocity(),
+         direction = pObserver->GetViewDirection();
+
+    std::tie(cx, cz) = GetChunkCenter(id);
+
+    vec2 d(cx - predicted.x, cz - predicted.z),
+         forward(direction.x, direction.z);  // shorter when looking up or down
+
+    distance = length(d);
+
+    // The chunks around the observer are needed, whatever the direction.
+    if (distance < CHUNK_SIZE)
+        return distance;
+
+    cosAngle = dot(forward, d) / distance;
+
+    return distance * (1.0f + 0.5f * (CHUNK_BEHIND_PRIORITY_FACTOR - 1.0f) * (length(forward) - cosAngle));
+}
+size_t ChunkWorker::GetLevel(const ChunkID, const ChunkObserver *) const
+{
+    return 0;
 }
 
 namespace std
@@ -48,8 +86,12 @@ namespace std
     }
 }
 
+bool ChunkJobEntry::operator>(const ChunkJobEntry &other) const
+{
+    return priority > other.priority;
+}
 ChunkWorkRecord::ChunkWorkRecord(const ChunkWorkRecord &other)
- :pWorker(other.pWorker), mChunks(other.mChunks.begin(), other.mChunks.end())
+ :pWorker(other.pWorker), mChunks(other.mChunks.begin(), other.mChunks.end()), mJobs(other.mJobs)
 {
 }
 ChunkWorkRecord::ChunkWorkRecord(void)
@@ -57,11 +99,11 @@ ChunkWorkRecord::ChunkWorkRecord(void)
 {
 }
 ChunkRecord::ChunkRecord(const ChunkRecord &other)
- :updating(other.updating), inRange(other.inRange)
+ :updating(other.updating), inRange(other.inRange), level(other.level)
 {
 }
 ChunkRecord::ChunkRecord(void)
- :updating(false), inRange(false)
+ :updating(false), inRange(false), level(0)
 {
 }
 ChunkManager::ChunkManager(const WorldSeed seed)
@@ -79,33 +121,40 @@ void ChunkManager::Start(void)
     Config config;
     App::Instance().GetConfig(config);
 
+    UpdateJobs();
+
     mChunkWorkManager.Start(max(1, int(config.loadConcurrency - 1)), ChunkWorkerThreadFunc, this);
-    mGarbageCollectThread = std::thread(ChunkGarbageCollectThreadFunc, this);
+    mUpdateThread = std::thread(ChunkUpdateThreadFunc, this);
 }
 void ChunkManager::Stop(void)
 {
-    working = false;
+    {
+        // Under the lock, so that no worker misses the notification.
+        std::scoped_lock lock(mtxLists);
+        working = false;
+    }
+    cvJobs.notify_all();
 
     mChunkWorkManager.JoinAll();
 
-    if (mGarbageCollectThread.joinable())
-        mGarbageCollectThread.join();
+    if (mUpdateThread.joinable())
+        mUpdateThread.join();
 
     ThrowAnyError();
 }
 void ChunkManager::ChunkWorkerThreadFunc(ChunkManager *p)
 {
     ChunkWorkRecord *pRecord;
-    ChunkID id;
+    ChunkJobEntry job;
 
     while (p->working)
     {
-        if (!(p->FindOneJob(id, pRecord)))
-            continue;
+        if (!(p->FindOneJob(job, pRecord)))
+            break;
 
         try
         {
-            pRecord->pWorker->PrepareFor(id, p->mSeed);
+            pRecord->pWorker->PrepareFor(job.id, job.level, p->mSeed);
         }
         catch (...)
         {
@@ -113,36 +162,53 @@ void ChunkManager::ChunkWorkerThreadFunc(ChunkManager *p)
         }
     }
 }
-void ChunkManager::ChunkGarbageCollectThreadFunc(ChunkManager *p)
+#define CHUNK_UPDATE_INTERVAL std::chrono::milliseconds(100)
+#define CHUNK_GARBAGECOLLECT_INTERVAL std::chrono::seconds(1)
+void ChunkManager::ChunkUpdateThreadFunc(ChunkManager *p)
 {
+    std::chrono::time_point<std::chrono::steady_clock> prevCollectTime = std::chrono::steady_clock::now(),
+                                                        time;
+
     while (p->working)
     {
         try
         {
-            p->GarbageCollect();
+            p->UpdateJobs();
+
+            time = std::chrono::steady_clock::now();
+            if ((time - prevCollectTime) >= CHUNK_GARBAGECOLLECT_INTERVAL)
+            {
+                p->GarbageCollect();
+                prevCollectTime = time;
+            }
         }
         catch (...)
         {
             p->PushError(std::current_exception());
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::this_thread::sleep_for(CHUNK_UPDATE_INTERVAL);
     }
 }
 void ChunkManager::Connect(ChunkWorker *p)
 {
-    std::scoped_lock(mtxLists);
+    std::scoped_lock lock(mtxLists);
 
     ChunkWorkRecord record;
     record.pWorker = p;
 
     mWorkRecords.push_back(record);
+
+    // Force a new schedule.
+    mObserverRecords.clear();
 }
 void ChunkManager::Connect(const ChunkObserver *p)
 {
-    std::scoped_lock(mtxLists);
+    std::scoped_lock lock(mtxLists);
 
     observerPs.push_back(p);
+
+    mObserverRecords.clear();
 }
 void ChunkManager::PushError(const std::exception_ptr &e)
 {
@@ -158,7 +224,7 @@ void ChunkManager::ThrowAnyError(void)
 }
 void ChunkManager::DestroyAll(void)
 {
-    std::scoped_lock(mtxLists);
+    std::scoped_lock lock(mtxLists);
 
     for (ChunkWorkRecord &record : mWorkRecords)
     {
@@ -169,6 +235,8 @@ void ChunkManager::DestroyAll(void)
 
         record.mChunks.clear();
     }
+
+    mObserverRecords.clear();
 }
 void ChunkManager::GarbageCollect(void)
 {
@@ -220,24 +288,27 @@ class ChunkPrepareJob: public Job
 {
     private:
         ChunkID id;
+        size_t level;
         WorldSeed seed;
         ChunkWorkRecord *pRecord;
     public:
-        ChunkPrepareJob(ChunkWorkRecord *p, const ChunkID cid, const WorldSeed s)
-         :pRecord(p), id(cid), seed(s)
+        ChunkPrepareJob(ChunkWorkRecord *p, const ChunkID cid, const size_t l, const WorldSeed s)
+         :pRecord(p), id(cid), level(l), seed(s)
         {
         }
 
         void Run(void)
         {
-            pRecord->pWorker->PrepareFor(id, seed);
+            pRecord->pWorker->PrepareFor(id, level, seed);
             pRecord->mChunks[id].updating = true;
+            pRecord->mChunks[id].level = level;
         }
 };
 void ChunkManager::TellInit(Queue &queue)
 {
     float radius, x, z;
     vec3 pos;
+    ChunkID id;
 
     for (ChunkWorkRecord &record : mWorkRecords)
     {
@@ -251,83 +322,160 @@ void ChunkManager::TellInit(Queue &queue)
             {
                 for (z = pos.z - radius; z < (pos.z + radius); z += CHUNK_SIZE)
                 {
-                    queue.Add(new ChunkPrepareJob(&record, GetChunkID(x, z), mSeed));
+                    id = GetChunkID(x, z);
+                    queue.Add(new ChunkPrepareJob(&record, id, record.pWorker->GetLevel(id, pObserver), mSeed));
                 }
             }
         }
     }
 }
-bool ChunkManager::FindOneJob(ChunkID &id, ChunkWorkRecord *&pRecord)
+// Reschedule when the view direction turned more than 30 degrees.
+#define CHUNK_RESCHEDULE_COS 0.866f
+void ChunkManager::UpdateJobs(void)
+{
+    vec3 pos, predicted;
+    ChunkObserverRecord observerRecord;
+    bool changed = false;
+
+    std::scoped_lock lock(mtxLists);
+
+    for (const ChunkObserver *pObserver : observerPs)
+    {
+        pos = pObserver->GetWorldPosition();
+        predicted = pos + CHUNK_PREDICTION_TIME * pObserver->GetVelocity();
+
+        observerRecord.centerID = GetChunkID(pos.x, pos.z);
+        observerRecord.predictedID = GetChunkID(predicted.x, predicted.z);
+        observerRecord.viewDirection = pObserver->GetViewDirection();
+
+        if (mObserverRecords.find(pObserver) == mObserverRecords.end())
+            changed = true;
+        else
+        {
+            const ChunkObserverRecord &prev = mObserverRecords.at(pObserver);
+
+            if (prev.centerID != observerRecord.centerID
+                    || prev.predictedID != observerRecord.predictedID)
+                changed = true;
+
+            else if (length(prev.viewDirection) > 0.0f && length(observerRecord.viewDirection) > 0.0f
+                     && dot(prev.viewDirection, observerRecord.viewDirection) < CHUNK_RESCHEDULE_COS)
+                changed = true;
+
+            // Keep the direction of the last schedule, so that slow turns add up.
+            else
+                continue;
+        }
+
+        mObserverRecords[pObserver] = observerRecord;
+    }
+
+    if (changed)
+    {
+        ScheduleJobs();
+
+        cvJobs.notify_all();
+    }
+}
+void ChunkManager::ScheduleJobs(void)
 {
-    float x, z, dx, dz, radius;
+    float radius, cx, cz, dx, dz;
     vec3 pos;
 
-    int64_t r;
+    int64_t countRings;
     int64_t chx, chz;
 
-    ChunkID centerID;
+    ChunkJobEntry job;
+    std::unordered_map<ChunkID, ChunkJobEntry> wanted;
 
     std::scoped_lock lock(mtxLists);
 
     for (ChunkWorkRecord &record : mWorkRecords)
     {
         radius = record.pWorker->GetWorkRadius();
+        countRings = int64_t(ceil(radius / CHUNK_SIZE));
 
-        for (const ChunkObserver *pObserver : observerPs)
+        wanted.clear();
+        for (const auto &pair : mObserverRecords)
         {
-            pos = pObserver->GetWorldPosition();
+            const ChunkObserver *pObserver = pair.first;
+            const ChunkID &centerID = pair.second.centerID;
 
-            centerID = GetChunkID(pos.x, pos.z);
+            pos = pObserver->GetWorldPosition();
 
-            /* Fill in nearby chunks, closest get priority.
-               After updating a single chunk, immediatly return so
-               that the center position can be reset.
-             */
-            for (r = 0; (r * CHUNK_SIZE) < radius; r++)
+            // Collect the chunks in range, the worker decides which go first and at what level.
+            for (chx = -countRings; chx <= countRings; chx++)
             {
-                for (chx = -r; chx <= r; chx++)
+                for (chz = -countRings; chz <= countRings; chz++)
                 {
-                    id.x = centerID.x + chx;
-
-                    id.z = centerID.z + r;
-                    if (!Updating(id, &record))
+                    job.id.x = centerID.x + chx;
+                    job.id.z = centerID.z + chz;
+
+                    // Same criterion as the garbage collector.
+                    std::tie(cx, cz) = GetChunkCenter(job.id);
+                    dx = cx - pos.x;
+                    dz = cz - pos.z;
+                    if ((dx * dx + dz * dz) >= radius * radius)
+                        continue;
+
+                    job.priority = record.pWorker->GetPriority(job.id, pObserver);
+                    job.level = record.pWorker->GetLevel(job.id, pObserver);
+
+                    // Where observers overlap, the most demanding one wins.
+                    if (wanted.find(job.id) == wanted.end())
+                        wanted.emplace(job.id, job);
+                    else
                     {
-                        pRecord = &record;
-                        pRecord->mChunks[id].updating = true;
-                        return true;
-                    }
-                    id.z = centerID.z - r;
-                    if (!Updating(id, &record))
-                    {
-                        pRecord = &record;
-                        pRecord->mChunks[id].updating = true;
-                        return true;
-                    }
-                }
-                for (chz = -r; chz <= r; chz++)
-                {
-                    id.z = centerID.z + chz;
-
-                    id.x = centerID.x + r;
-                    if (!Updating(id, &record))
-                    {
-                        pRecord = &record;
-                        pRecord->mChunks[id].updating = true;
-                        return true;
-                    }
-                    id.x = centerID.x - r;
-                    if (!Updating(id, &record))
-                    {
-                        pRecord = &record;
-                        pRecord->mChunks[id].updating = true;
-                        return true;
+                        ChunkJobEntry &other = wanted.at(job.id);
+                        other.priority = min(other.priority, job.priority);
+                        other.level = std::min(other.level, job.level);
                     }
                 }
             }
         }
+
+        record.mJobs = ChunkJobQueue();
+        for (const auto &pair : wanted)
+        {
+            if (!UpToDate(pair.second, &record))
+                record.mJobs.push(pair.second);
+        }
     }
+}
+bool ChunkManager::TakeOneJob(ChunkJobEntry &job, ChunkWorkRecord *&pRecord)
+{
+    std::scoped_lock lock(mtxLists);
 
-    return false;
+    pRecord = NULL;
+    for (ChunkWorkRecord &record : mWorkRecords)
+    {
+        // Drop the entries that were taken already.
+        while (!record.mJobs.empty() && UpToDate(record.mJobs.top(), &record))
+            record.mJobs.pop();
+
+        if (!record.mJobs.empty()
+                && (pRecord == NULL || record.mJobs.top().priority < pRecord->mJobs.top().priority))
+            pRecord = &record;
+    }
+
+    if (pRecord == NULL)
+        return false;
+
+    job = pRecord->mJobs.top();
+    pRecord->mJobs.pop();
+    pRecord->mChunks[job.id].updating = true;
+    pRecord->mChunks[job.id].level = job.level;
+
+    return true;
+}
+bool ChunkManager::FindOneJob(ChunkJobEntry &job, ChunkWorkRecord *&pRecord)
+{
+    std::unique_lock lock(mtxLists);
+
+    // Sleep until the observers move or the manager stops.
+    cvJobs.wait(lock, [&] { return !working || TakeOneJob(job, pRecord); });
+
+    return working;
 }
 bool ChunkManager::Updating(const ChunkID id, const ChunkWorkRecord *pRecord)
 {
@@ -336,3 +484,7 @@ bool ChunkManager::Updating(const ChunkID id, const ChunkWorkRecord *pRecord)
 
     return pRecord->mChunks.at(id).updating;
 }
+bool ChunkManager::UpToDate(const ChunkJobEntry &job, const ChunkWorkRecord *pRecord)
+{
+    return Updating(job.id, pRecord) && pRecord->mChunks.at(job.id).level == job.level;
+}
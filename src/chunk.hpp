@@ -3,8 +3,11 @@
 
 #include <tuple>
 #include <list>
+#include <vector>
+#include <queue>
 #include <unordered_map>
 #include <thread>
+#include <condition_variable>
 
 #include <glm/glm.hpp>
 using namespace glm;
@@ -44,64 +47,119 @@ std::tuple<float, float> GetChunkCenter(const ChunkID id);
 /**
  *  Must be thread-safe!
  */
-class ChunkWorker
+class ChunkObserver
 {
     public:
-        virtual void PrepareFor(const ChunkID, const WorldSeed) = 0;
-        virtual void DestroyFor(const ChunkID) = 0;
-        virtual float GetWorkRadius(void) const = 0;
+        virtual vec3 GetWorldPosition(void) const = 0;
+
+        // Unit vector. By default zero, meaning that the observer looks in all directions.
+        virtual vec3 GetViewDirection(void) const;
+
+        // In world units per second. By default zero.
+        virtual vec3 GetVelocity(void) const;
 };
 
 /**
  *  Must be thread-safe!
  */
-class ChunkObserver
+class ChunkWorker
 {
     public:
-        virtual vec3 GetWorldPosition(void) const = 0;
+        // May be called again for a chunk that was prepared before, at another level of detail.
+        virtual void PrepareFor(const ChunkID, const size_t level, const WorldSeed) = 0;
+        virtual void DestroyFor(const ChunkID) = 0;
+        virtual float GetWorkRadius(void) const = 0;
+
+        /**
+         *  Level of detail, 0 is the finest. When the level changes, the chunk gets prepared again.
+         *  With multiple observers, the finest level wins. By default always 0.
+         */
+        virtual size_t GetLevel(const ChunkID, const ChunkObserver *) const;
+
+        /**
+         *  Chunks with the lowest priority value get prepared first.
+         *  By default, the distance from where the observer is heading to,
+         *  raised for chunks that are not in the observer's view direction.
+         */
+        virtual float GetPriority(const ChunkID, const ChunkObserver *) const;
 };
 
 struct ChunkRecord
 {
     bool updating,
          inRange;
+    size_t level;  // at the last time it was prepared
 
     ChunkRecord(const ChunkRecord &);
     ChunkRecord(void);
 };
 
+struct ChunkJobEntry
+{
+    float priority;  // lowest goes first
+    ChunkID id;
+    size_t level;
+
+    bool operator>(const ChunkJobEntry &) const;
+};
+
+typedef std::priority_queue<ChunkJobEntry, std::vector<ChunkJobEntry>, std::greater<ChunkJobEntry>> ChunkJobQueue;
+
 struct ChunkWorkRecord
 {
     ChunkWorker *pWorker;
     std::unordered_map<ChunkID, ChunkRecord> mChunks;
 
+    // Chunks that were missing or at the wrong level at the last schedule.
+    ChunkJobQueue mJobs;
+
     ChunkWorkRecord(const ChunkWorkRecord &);
     ChunkWorkRecord(void);
 };
 
+struct ChunkObserverRecord
+{
+    ChunkID centerID,
+            predictedID;
+    vec3 viewDirection;
+};
+
 class ChunkManager: public Initializable
 {
     private:
         WorldSeed mSeed;
 
-        std::thread mGarbageCollectThread;
+        std::thread mUpdateThread;
         ConcurrentManager mChunkWorkManager;
         std::atomic<bool> working;
 
-        static void ChunkGarbageCollectThreadFunc(ChunkManager *);
+        static void ChunkUpdateThreadFunc(ChunkManager *);
         static void ChunkWorkerThreadFunc(ChunkManager *);
 
         void GarbageCollect(void);
-        bool FindOneJob(ChunkID &, ChunkWorkRecord *&);
+
+        /**
+         *  Rebuilds the job queues, but only when an observer has moved to another chunk,
+         *  is heading for another chunk or has turned around. Wakes up the waiting workers if so.
+         */
+        void UpdateJobs(void);
+        void ScheduleJobs(void);
+
+        // Blocks until there's a job. Returns false if the manager was stopped.
+        bool FindOneJob(ChunkJobEntry &, ChunkWorkRecord *&);
+        bool TakeOneJob(ChunkJobEntry &, ChunkWorkRecord *&);
         bool Updating(const ChunkID, const ChunkWorkRecord *);
+        bool UpToDate(const ChunkJobEntry &, const ChunkWorkRecord *);
 
         std::list<std::exception_ptr> mErrors;
         std::recursive_mutex mtxError;
         void PushError(const std::exception_ptr &);
 
         std::recursive_mutex mtxLists;
+        std::condition_variable_any cvJobs;
         std::list<ChunkWorkRecord> mWorkRecords;
         std::list<const ChunkObserver *> observerPs;
+        std::unordered_map<const ChunkObserver *, ChunkObserverRecord> mObserverRecords;  // at the last schedule
     public:
         ChunkManager(const WorldSeed);
         ~ChunkManager(void);
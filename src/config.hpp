@@ -17,6 +17,10 @@ struct Resolution
 struct Rendering
 {
     GLfloat distance;
+
+    // Per frame, the GL jobs stop when either is exceeded.
+    double uploadMillis;
+    size_t uploadBytes;
 };
 
 enum KeyBinding
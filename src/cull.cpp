@@ -0,0 +1,108 @@
+#include <algorithm>
+
+#include "cull.hpp"
+
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define CULL_SSE_KERNEL
+#include <emmintrin.h>
+#endif
+
+
+void BoundingBoxes::Clear(void)
+{
+    mMinX.clear();
+    mMinY.clear();
+    mMinZ.clear();
+    mMaxX.clear();
+    mMaxY.clear();
+    mMaxZ.clear();
+}
+void BoundingBoxes::Add(const vec3 &min, const vec3 &max)
+{
+    mMinX.push_back(min.x);
+    mMinY.push_back(min.y);
+    mMinZ.push_back(min.z);
+    mMaxX.push_back(max.x);
+    mMaxY.push_back(max.y);
+    mMaxZ.push_back(max.z);
+}
+void BoundingBoxes::Get(const size_t i, vec3 &min, vec3 &max) const
+{
+    min = vec3(mMinX[i], mMinY[i], mMinZ[i]);
+    max = vec3(mMaxX[i], mMaxY[i], mMaxZ[i]);
+}
+size_t BoundingBoxes::Size(void) const
+{
+    return mMinX.size();
+}
+Frustum::Frustum(const mat4 &m)
+{
+    // The rows of the matrix, glm is column major.
+    vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]),
+         r1(m[0][1], m[1][1], m[2][1], m[3][1]),
+         r2(m[0][2], m[1][2], m[2][2], m[3][2]),
+         r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    mPlanes[0] = r3 + r0;  // left
+    mPlanes[1] = r3 - r0;  // right
+    mPlanes[2] = r3 + r1;  // bottom
+    mPlanes[3] = r3 - r1;  // top
+    mPlanes[4] = r3 + r2;  // near
+    mPlanes[5] = r3 - r2;  // far
+}
+/**
+ *  For each plane, the box corner furthest along the plane's normal is tested.
+ *  Taking the max of the min and max products picks that corner without branching.
+ */
+void Frustum::CullBoxes(const BoundingBoxes &boxes, uint8_t *visible) const
+{
+    size_t i = 0, count = boxes.Size(), j;
+
+#ifdef CULL_SSE_KERNEL
+    for (; (i + 4) <= count; i += 4)
+    {
+        __m128 minX = _mm_loadu_ps(&boxes.mMinX[i]),
+               minY = _mm_loadu_ps(&boxes.mMinY[i]),
+               minZ = _mm_loadu_ps(&boxes.mMinZ[i]),
+               maxX = _mm_loadu_ps(&boxes.mMaxX[i]),
+               maxY = _mm_loadu_ps(&boxes.mMaxY[i]),
+               maxZ = _mm_loadu_ps(&boxes.mMaxZ[i]),
+               outside = _mm_setzero_ps();
+
+        for (const vec4 &plane : mPlanes)
+        {
+            __m128 nx = _mm_set1_ps(plane.x),
+                   ny = _mm_set1_ps(plane.y),
+                   nz = _mm_set1_ps(plane.z),
+                   d = _mm_set1_ps(plane.w);
+
+            d = _mm_add_ps(d, _mm_max_ps(_mm_mul_ps(nx, minX), _mm_mul_ps(nx, maxX)));
+            d = _mm_add_ps(d, _mm_max_ps(_mm_mul_ps(ny, minY), _mm_mul_ps(ny, maxY)));
+            d = _mm_add_ps(d, _mm_max_ps(_mm_mul_ps(nz, minZ), _mm_mul_ps(nz, maxZ)));
+
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+        }
+
+        int mask = _mm_movemask_ps(outside);
+        for (j = 0; j < 4; j++)
+            visible[i + j] = ((mask >> j) & 1) ? 0 : 1;
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        visible[i] = 1;
+        for (const vec4 &plane : mPlanes)
+        {
+            float d = plane.w + std::max(plane.x * boxes.mMinX[i], plane.x * boxes.mMaxX[i])
+                              + std::max(plane.y * boxes.mMinY[i], plane.y * boxes.mMaxY[i])
+                              + std::max(plane.z * boxes.mMinZ[i], plane.z * boxes.mMaxZ[i]);
+            if (d < 0.0f)
+            {
+                visible[i] = 0;
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CULL_HPP
+#define CULL_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+using namespace glm;
+
+
+/**
+ *  Axis aligned boxes, stored per coordinate so that they can be tested four at a time.
+ */
+class BoundingBoxes
+{
+    private:
+        std::vector<float> mMinX, mMinY, mMinZ,
+                           mMaxX, mMaxY, mMaxZ;
+    public:
+        void Clear(void);
+        void Add(const vec3 &min, const vec3 &max);
+        void Get(const size_t i, vec3 &min, vec3 &max) const;
+        size_t Size(void) const;
+
+    friend class Frustum;
+};
+
+class Frustum
+{
+    private:
+        // Inside is where dot(plane, vec4(p, 1.0)) >= 0.
+        vec4 mPlanes[6];
+    public:
+        Frustum(const mat4 &projectionView);
+
+        /**
+         *  Sets visible[i] to 1 if box i is at least partly inside, 0 otherwise.
+         *  Boxes near the corners may be kept, even if they're outside.
+         */
+        void CullBoxes(const BoundingBoxes &, uint8_t *visible) const;
+};
+
+#endif  // CULL_HPP
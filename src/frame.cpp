@@ -0,0 +1,31 @@
+#include "frame.hpp"
+#include "app.hpp"
+#include "error.hpp"
+
+
+static_assert(sizeof(FrameUniforms) == 192, "FrameUniforms doesn't match the std140 layout");
+
+void FrameUniformBuffer::Init(void)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    pBuffer = App::Instance().GetGLManager()->AllocBuffer();
+
+    pState->BindBuffer(GL_UNIFORM_BUFFER, *pBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_STREAM_DRAW);
+    CHECK_GL();
+}
+void FrameUniformBuffer::Set(const FrameUniforms &uniforms)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    pState->BindBuffer(GL_UNIFORM_BUFFER, *pBuffer);
+
+    // Orphan the old data, the GPU may still be reading it.
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_STREAM_DRAW);
+    CHECK_GL();
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+    CHECK_GL();
+
+    pState->BindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, *pBuffer);
+}
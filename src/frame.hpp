@@ -0,0 +1,62 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <glm/glm.hpp>
+using namespace glm;
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "alloc.hpp"
+
+
+// Where all programs find the frame data.
+#define FRAME_UNIFORMS_BINDING 0
+
+/**
+ *  Paste this into a shader, after the version, to access the frame data.
+ *  Must match the FrameUniforms struct, in the std140 layout.
+ */
+#define FRAME_UNIFORM_BLOCK_GLSL \
+    "layout(std140) uniform FrameData\n" \
+    "{\n" \
+    "    mat4 projectionMatrix;\n" \
+    "    mat4 viewMatrix;\n" \
+    "    vec4 horizonColor;\n" \
+    "    vec4 skyColor;\n" \
+    "    vec3 lightDirection;\n" \
+    "    float horizonDistance;\n" \
+    "    vec3 center;\n" \
+    "    float time;\n" \
+    "};\n"
+
+#define FRAME_UNIFORM_BLOCK_NAME "FrameData"
+
+/**
+ *  The same for all renderers during one frame. The vec3s are followed
+ *  by a float, so that the struct has no padding, like std140.
+ */
+struct FrameUniforms
+{
+    mat4 projectionMatrix,
+         viewMatrix;
+    vec4 horizonColor,
+         skyColor;
+    vec3 lightDirection;
+    float horizonDistance;
+    vec3 center;
+    float time;
+};
+
+class FrameUniformBuffer
+{
+    private:
+        GLRef pBuffer;
+    public:
+        // GL thread.
+        void Init(void);
+
+        // Uploads the data and binds the buffer to FRAME_UNIFORMS_BINDING.
+        void Set(const FrameUniforms &);
+};
+
+#endif  // FRAME_HPP
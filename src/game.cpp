@@ -10,10 +10,12 @@
 
 
 #define DAYPERIOD 5.0
+#define WORLDSEED 483417628069
 
 InGameScene::InGameScene(void)
-: mChunkManager(483417628069),
+: mGroundRenderer(WORLDSEED),
   mSkyRenderer(20),
+  mChunkManager(WORLDSEED),
   prevTime(std::chrono::system_clock::now()), t(0.0f)
 {
     mChunkManager.Connect(&mGroundRenderer);
@@ -36,11 +38,13 @@ InGameScene::~InGameScene(void)
     mChunkManager.DestroyAll();
 }
 Player::Player(void)
- :yaw(0.0f), pitch(0.0f), position(0.0f, 2.0f, 0.0f)
+ :yaw(0.0f), pitch(0.0f), position(0.0f, 2.0f, 0.0f), velocity(0.0f, 0.0f, 0.0f)
 {
 }
 void InGameScene::TellInit(Queue &queue)
 {
+    mFrameUniformBuffer.Init();
+    App::Instance().GetFontManager()->TellInit(queue, "tiki.svg");
     mTextRenderer.TellInit(queue);
     mChunkManager.TellInit(queue);
     mSkyRenderer.TellInit(queue);
@@ -100,6 +104,8 @@ void Player::Update(const float dt)
     {
         std::scoped_lock lock(mtxPosition);
 
+        vec3 prevPosition = position;
+
         if (mKeyInterpreter.IsKeyDown(KEYB_JUMP))
             position += vec3(0.0f, 1.0f, 0.0f) * MOVE_SPEED * dt;
         else if(mKeyInterpreter.IsKeyDown(KEYB_DUCK))
@@ -114,6 +120,9 @@ void Player::Update(const float dt)
             position += MOVE_SPEED * dt * rotate(vec3(-1.0f, 0.0f, 0.0f), radians(yaw), vec3(0.0f, 1.0f, 0.0f));
         else if(mKeyInterpreter.IsKeyDown(KEYB_GORIGHT))
             position += MOVE_SPEED * dt * rotate(vec3(1.0f, 0.0f, 0.0f), radians(yaw), vec3(0.0f, 1.0f, 0.0f));
+
+        if (dt > 0.0f)
+            velocity = (position - prevPosition) / dt;
     }
 }
 void InGameScene::Render(void)
@@ -150,16 +159,30 @@ void InGameScene::Render(void)
     view = rotate(view, radians(mPlayer.GetPitch()), vec3(1.0f, 0.0f, 0.0f));
     view = inverse(view);
 
-    mSkyRenderer.Render(proj, view, position.y, horizonColor, skyColor);
+    // Shared by all renderers, uploaded once.
+    FrameUniforms uniforms;
+    uniforms.projectionMatrix = proj;
+    uniforms.viewMatrix = view;
+    uniforms.horizonColor = horizonColor;
+    uniforms.skyColor = skyColor;
+    uniforms.lightDirection = lightDirection;
+    uniforms.horizonDistance = config.render.distance;
+    uniforms.center = position;
+    uniforms.time = t;
+    mFrameUniformBuffer.Set(uniforms);
+
+    mSkyRenderer.Render();
 
-    mGroundRenderer.Render(proj, view, position, horizonColor, lightDirection);
+    mGroundRenderer.Render(proj, view, position);
 
-    mWaterRenderer.Render(proj, view, position, lightDirection, t);
+    mWaterRenderer.Render();
 
     char text[256];
-    sprintf(text, "dt: %.3f, FPS: %.1f", dt, 1.0f / dt);
-    mTextRenderer.IterateText(App::Instance().GetFontManager()->GetFont(FONT_SMALLBLACK),
-                              (int8_t *)text, mTextParams);
+    sprintf(text, "dt: %.3f, FPS: %.1f, deferred GL jobs: %u, occluded chunks: %u, ground: %.2f ms, saved: %.2f ms",
+            dt, 1.0f / dt, (unsigned int)App::Instance().CountDeferredGL(),
+            (unsigned int)mGroundRenderer.CountOccludedChunks(),
+            mGroundRenderer.GetDrawMillis(), mGroundRenderer.GetOcclusionSavedMillis());
+    mTextRenderer.RenderText(FONT_SMALLBLACK, (int8_t *)text, mTextParams);
 }
 void InGameScene::OnEvent(const SDL_Event &event)
 {
@@ -186,6 +209,20 @@ vec3 Player::GetWorldPosition(void) const
 
     return position;
 }
+vec3 Player::GetViewDirection(void) const
+{
+    std::scoped_lock lock(mtxPosition);
+
+    // Same rotations as the view matrix.
+    return rotate(rotate(vec3(0.0f, 0.0f, -1.0f), radians(pitch), vec3(1.0f, 0.0f, 0.0f)),
+                  radians(yaw), vec3(0.0f, 1.0f, 0.0f));
+}
+vec3 Player::GetVelocity(void) const
+{
+    std::scoped_lock lock(mtxPosition);
+
+    return velocity;
+}
 float Player::GetYaw(void) const
 {
     std::scoped_lock lock(mtxPosition);
@@ -11,6 +11,7 @@
 #include "ground.hpp"
 #include "water.hpp"
 #include "sky.hpp"
+#include "frame.hpp"
 #include "concurrency.hpp"
 #include "text.hpp"
 
@@ -30,13 +31,16 @@ class Player: public ChunkObserver, public EventListener
     private:
         KeyInterpreter mKeyInterpreter;
 
-        vec3 position;
+        vec3 position,
+             velocity;
         float yaw, pitch;
         mutable std::recursive_mutex mtxPosition;
     public:
         Player(void);
 
         vec3 GetWorldPosition(void) const;
+        vec3 GetViewDirection(void) const;
+        vec3 GetVelocity(void) const;
         float GetYaw(void) const;
         float GetPitch(void) const;
 
@@ -61,6 +65,7 @@ class InGameScene: public InitializableScene
         WaterRenderer mWaterRenderer;
         GroundRenderer mGroundRenderer;
         SkyRenderer mSkyRenderer;
+        FrameUniformBuffer mFrameUniformBuffer;
         ChunkManager mChunkManager;
     public:
         InGameScene(void);
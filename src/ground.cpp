@@ -1,5 +1,8 @@
 #include <cmath>
+#include <algorithm>
+#include <memory>
 
+#include <boost/format.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -7,17 +10,27 @@
 #include "error.hpp"
 #include "shader.hpp"
 #include "ground.hpp"
+#include "frame.hpp"
 #include "texture.hpp"
+#include "synth.hpp"
 
 
-#define GROUND_POSITION_INDEX 0
+#define GROUND_HEIGHT_INDEX 0
 #define GROUND_NORMAL_INDEX 1
 
-const char groundVertexShaderSrc[] = R"shader(
-#version 150
+const size_t groundLevelSteps[COUNT_GROUND_LEVELS] = {1, 2, 4, 10, 20, 50};
+const float groundLevelDistances[COUNT_GROUND_LEVELS - 1] = {250.0f, 500.0f, 1000.0f, 2000.0f, 4000.0f};
 
-in vec3 position;
-in vec3 normal;
+/**
+ *  All chunks are drawn in one call. The vertex index tells which slot
+ *  the vertex is in, the slot tells where the chunk is.
+ *
+ *  Within a chunk, the x and z coords follow from the vertex index.
+ *  The grid comes first, then the skirts along the four edges.
+ */
+const std::string groundVertexShaderSrc = (boost::format("#version 150\n" FRAME_UNIFORM_BLOCK_GLSL R"shader(
+in float height;
+in vec2 normal;  // octahedral encoded
 
 out VertexData
 {
@@ -26,27 +39,72 @@ out VertexData
     float distance;
 } vertexOut;
 
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+uniform int poolBases[%2%];
+uniform int poolFirstSlots[%2%];
+uniform int poolStrides[%1%];
+
+uniform samplerBuffer chunkData;
+
+const int countPools = %1%;
+const float heightUnit = %3%;
+
+vec3 DecodeNormal(vec2 e)
+{
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+
+    if (n.y < 0.0)
+        n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(n);
+}
 
 void main()
 {
+    int pool = 0;
+    while (pool < (countPools - 1) && gl_VertexID >= poolBases[pool + 1])
+        pool++;
+
+    int offset = gl_VertexID - poolBases[pool],
+        slot = poolFirstSlots[pool] + offset / poolStrides[pool],
+        vertexID = offset %% poolStrides[pool];
+
+    vec4 chunk = texelFetch(chunkData, slot);
+    vec2 chunkOrigin = chunk.xy;
+    float chunkScale = chunk.z;
+    int countRowPoints = int(chunk.w);
+
+    int ix, iz,
+        i = vertexID - countRowPoints * countRowPoints;
+
+    if (i < 0)
+    {
+        ix = vertexID / countRowPoints;
+        iz = vertexID %% countRowPoints;
+    }
+    else
+    {
+        int side = i / countRowPoints,
+            j = i %% countRowPoints,
+            edge = (side %% 2) * (countRowPoints - 1);
+
+        ix = side < 2 ? edge : j;
+        iz = side < 2 ? j : edge;
+    }
+
+    vec3 position = vec3(chunkOrigin.x + float(ix) * chunkScale,
+                         height * heightUnit,
+                         chunkOrigin.y + float(iz) * chunkScale);
+
     gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0);
     vertexOut.texCoords = position.xz / 5.0;
-    vertexOut.worldSpaceNormal = normal;
+    vertexOut.worldSpaceNormal = DecodeNormal(normal);
     vertexOut.distance = -(viewMatrix * vec4(position, 1.0)).z;
 }
-)shader",
-
-groundFragmentShaderSrc[] = R"shader(
-#version 150
+)shader") % COUNT_GROUND_LEVELS % (COUNT_GROUND_LEVELS + 1) % GROUND_HEIGHT_UNIT).str();
 
+const char groundFragmentShaderSrc[] = "#version 150\n" FRAME_UNIFORM_BLOCK_GLSL R"shader(
 uniform sampler2D tex;
 
-uniform vec3 lightDirection;
-uniform vec4 horizonColor;
-uniform float horizonDistance;
-
 const vec4 sunColor = vec4(0.8, 0.6, 0.3, 1.0);
 const vec4 ambientColor = vec4(0.2, 0.4, 0.7, 1.0);
 
@@ -75,70 +133,240 @@ void main()
 }
 )shader";
 
+// Two octaves: a wide one of 250 units and a narrow one of 50.
 GroundGenerator::GroundGenerator(const WorldSeed seed)
-: mNoiseGenerator(seed)
+: mNoiseGenerator(seed), mOctaves(2, 1.0f / 250, 5.0f, 1.0f, 10.0f)
 {
 }
 float GroundGenerator::GetVerticalCoord(const vec2 &p) const
 {
-    return 10 * (mNoiseGenerator.Noise(p / 50.0f) + mNoiseGenerator.Noise(p / 250.0f));
+    return mNoiseGenerator.OctaveNoise(p, mOctaves);
+}
+void GroundGenerator::GetVerticalCoords(const vec2 &origin, const float spacing, const size_t count, float *heights) const
+{
+    std::unique_ptr<float[]> xs(new float[count]),
+                             zs(new float[count]);
+    size_t ix, iz;
+
+    for (iz = 0; iz < count; iz++)
+        zs[iz] = origin.y + float(iz) * spacing;
+
+    for (ix = 0; ix < count; ix++)
+    {
+        std::fill(xs.get(), xs.get() + count, origin.x + float(ix) * spacing);
+
+        mNoiseGenerator.BatchOctaveNoise(xs.get(), zs.get(), heights + ix * count, count, mOctaves);
+    }
+}
+// The chunk covers the same square as GetChunkID and GetChunkCenter.
+vec2 GetGroundChunkOrigin(const ChunkID id)
+{
+    return vec2(float(id.x) * CHUNK_SIZE,
+                float(id.z) * CHUNK_SIZE);
+}
+void SetGroundRenderVertex(GroundRenderVertex &vertex, const float height, const vec3 &normal)
+{
+    vertex.height = GLshort(std::round(clamp(height / GROUND_HEIGHT_UNIT, -32767.0f, 32767.0f)));
+
+    // Octahedral encoding, folded over the y-axis, since most normals point up.
+    float l = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    vec2 e(normal.x / l, normal.z / l);
+
+    if (normal.y < 0.0f)
+        e = vec2((1.0f - std::fabs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+                 (1.0f - std::fabs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f));
+
+    vertex.normal[0] = GLbyte(std::round(clamp(e.x, -1.0f, 1.0f) * 127.0f));
+    vertex.normal[1] = GLbyte(std::round(clamp(e.y, -1.0f, 1.0f) * 127.0f));
+}
+size_t CountGroundChunkRowPoints(const size_t level)
+{
+    return COUNT_CHUNKROW_TILES / groundLevelSteps[level] + 1;
+}
+size_t CountGroundChunkVertices(const size_t level)
+{
+    size_t n = CountGroundChunkRowPoints(level);
+
+    return n * n + 4 * n;
+}
+size_t CountGroundChunkIndices(const size_t level)
+{
+    size_t n = CountGroundChunkRowPoints(level);
+
+    // Skirt quads get both windings, they can be seen from either side.
+    return 6 * (n - 1) * (n - 1) + 4 * 12 * (n - 1);
+}
+size_t GetOnChunkIndexFor(const size_t countRowPoints, const size_t ix, const size_t iz)
+{
+    return ix * countRowPoints + iz;
+}
+/**
+ *  Side 0 and 1 run along iz at ix = 0 and ix = n - 1,
+ *  side 2 and 3 run along ix at iz = 0 and iz = n - 1.
+ */
+size_t GetOnChunkSkirtIndexFor(const size_t countRowPoints, const size_t side, const size_t j)
+{
+    return countRowPoints * countRowPoints + side * countRowPoints + j;
+}
+size_t GetOnChunkEdgeIndexFor(const size_t countRowPoints, const size_t side, const size_t j)
+{
+    size_t edge = (side % 2) * (countRowPoints - 1);
+
+    if (side < 2)
+        return GetOnChunkIndexFor(countRowPoints, edge, j);
+    else
+        return GetOnChunkIndexFor(countRowPoints, j, edge);
+}
+size_t GetOnHeightGridIndexFor(const size_t countRowPoints, const size_t ix, const size_t iz)
+{
+    // The height grid starts one row and one column before the chunk's first point.
+    return (ix + 1) * (countRowPoints + 2) + (iz + 1);
 }
-size_t GetOnChunkIndexFor(const size_t ix, const size_t iz)
+#define GROUND_MAX_VERTEXBUFFER_SIZE (CountGroundChunkVertices(0) * sizeof(GroundRenderVertex))
+void FillGroundChunkIndices(const size_t level, GroundRenderIndex *indices)
 {
-    return ix * COUNT_CHUNKROW_POINTS + iz;
+    size_t n = CountGroundChunkRowPoints(level),
+           ix, iz, side, j, k, indexCount = 0;
+
+    for (ix = 0; ix < (n - 1); ix++)
+    {
+        for (iz = 0; iz < (n - 1); iz++)
+        {
+            indices[indexCount + 0] = GetOnChunkIndexFor(n, ix, iz);
+            indices[indexCount + 1] = GetOnChunkIndexFor(n, ix, iz + 1);
+            indices[indexCount + 2] = GetOnChunkIndexFor(n, ix + 1, iz + 1);
+
+            indices[indexCount + 3] = GetOnChunkIndexFor(n, ix, iz);
+            indices[indexCount + 4] = GetOnChunkIndexFor(n, ix + 1, iz + 1);
+            indices[indexCount + 5] = GetOnChunkIndexFor(n, ix + 1, iz);
+
+            indexCount += 6;
+        }
+    }
+
+    for (side = 0; side < 4; side++)
+    {
+        for (j = 0; j < (n - 1); j++)
+        {
+            GroundRenderIndex quad[4] = {GroundRenderIndex(GetOnChunkEdgeIndexFor(n, side, j)),
+                                         GroundRenderIndex(GetOnChunkEdgeIndexFor(n, side, j + 1)),
+                                         GroundRenderIndex(GetOnChunkSkirtIndexFor(n, side, j + 1)),
+                                         GroundRenderIndex(GetOnChunkSkirtIndexFor(n, side, j))};
+            const size_t order[12] = {0, 1, 2, 0, 2, 3,
+                                      0, 2, 1, 0, 3, 2};
+            for (k = 0; k < 12; k++)
+                indices[indexCount + k] = quad[order[k]];
+
+            indexCount += 12;
+        }
+    }
 }
-#define GROUND_VERTEXBUFFER_SIZE (COUNT_GROUND_CHUNKRENDER_VERTICES * sizeof(GroundRenderVertex))
-#define GROUND_INDEXBUFFER_SIZE (COUNT_GROUND_CHUNKRENDER_INDICES * sizeof(GroundRenderIndex))
 class GroundChunkBufferFillJob: public Job
 {
     private:
         ChunkID id;
         GroundRenderer *pRenderer;
         GroundChunkRenderObj *pObj;
+
+        // The vertices are either in a staging slot, or in ordinary memory.
+        size_t stagingSlot;
+        bool holdsSlot;
+        std::unique_ptr<GroundRenderVertex[]> pVertices;
     public:
-        GroundChunkBufferFillJob(GroundRenderer *pR, const ChunkID cid, GroundChunkRenderObj *p)
-        : pRenderer(pR), id(cid), pObj(p)
+        GroundChunkBufferFillJob(GroundRenderer *pR, const ChunkID cid, GroundChunkRenderObj *p,
+                                 const size_t slot)
+        : pRenderer(pR), id(cid), pObj(p), stagingSlot(slot), holdsSlot(true)
+        {
+        }
+
+        GroundChunkBufferFillJob(GroundRenderer *pR, const ChunkID cid, GroundChunkRenderObj *p,
+                                 std::unique_ptr<GroundRenderVertex[]> &&pV)
+        : pRenderer(pR), id(cid), pObj(p), holdsSlot(false), pVertices(std::move(pV))
+        {
+        }
+
+        // The slot goes along with the job, when it's pushed again.
+        GroundChunkBufferFillJob(GroundChunkBufferFillJob &&other)
+        : pRenderer(other.pRenderer), id(other.id), pObj(other.pObj),
+          stagingSlot(other.stagingSlot), holdsSlot(other.holdsSlot), pVertices(std::move(other.pVertices))
+        {
+            other.holdsSlot = false;
+        }
+
+        // When the job is thrown away without running, the slot must still be given back.
+        ~GroundChunkBufferFillJob(void)
+        {
+            if (holdsSlot)
+                pRenderer->mStagingBuffer.Release(stagingSlot);
+        }
+
+        float GetPriority(void) const
+        {
+            return pRenderer->GetUploadPriority(id);
+        }
+
+        size_t GetUploadSize(void) const
         {
+            // Copying from a staging slot happens on the GPU.
+            if (pVertices)
+                return CountGroundChunkVertices(pObj->level) * sizeof(GroundRenderVertex);
+            else
+                return 0;
         }
 
         void Run(void)
         {
-            glGenBuffers(1, &(pObj->mVertexBuffer));
-            CHECK_GL();
+            GLState *pState = App::Instance().GetGLState();
 
-            glGenBuffers(1, &(pObj->mIndexBuffer));
-            CHECK_GL();
+            size_t size = CountGroundChunkVertices(pObj->level) * sizeof(GroundRenderVertex);
 
-            glBindBuffer(GL_ARRAY_BUFFER, pObj->mVertexBuffer);
-            CHECK_GL();
-            glBufferData(GL_ARRAY_BUFFER, GROUND_VERTEXBUFFER_SIZE, pObj->vertices, GL_DYNAMIC_DRAW);
-            CHECK_GL();
+            if (!pRenderer->AllocSlot(pObj->level, pObj->slot))
+            {
+                // All slots taken, try again when other chunks have been deleted.
+                App::Instance().PushGL(new GroundChunkBufferFillJob(std::move(*this)));
+                return;
+            }
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pObj->mIndexBuffer);
-            CHECK_GL();
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, GROUND_INDEXBUFFER_SIZE, pObj->indices, GL_DYNAMIC_DRAW);
-            CHECK_GL();
+            GLintptr offset = pRenderer->GetSlotBaseVertex(pObj->slot) * sizeof(GroundRenderVertex);
+            if (pVertices)
+            {
+                pState->BindBuffer(GL_ARRAY_BUFFER, *(pRenderer->pVertexBuffer));
+
+                glBufferSubData(GL_ARRAY_BUFFER, offset, size, pVertices.get());
+                CHECK_GL();
+
+                pState->BindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            else
+            {
+                pRenderer->mStagingBuffer.CopyTo(stagingSlot, *(pRenderer->pVertexBuffer), offset, size);
+                holdsSlot = false;
+            }
 
+            pRenderer->SetChunkData(pObj->slot, id, pObj->level);
             pRenderer->Set(id, pObj);
         }
 };
 class GroundChunkBufferDeleteJob: public Job
 {
     private:
+        GroundRenderer *pRenderer;
         GroundChunkRenderObj *pObj;
     public:
-        GroundChunkBufferDeleteJob(GroundChunkRenderObj *p)
-        :pObj(p)
+        GroundChunkBufferDeleteJob(GroundRenderer *pR, GroundChunkRenderObj *p)
+        : pRenderer(pR), pObj(p)
         {
         }
 
-        void Run(void)
+        // Frees memory, so let it go first.
+        float GetPriority(void) const
         {
-            glDeleteBuffers(1, &(pObj->mVertexBuffer));
-            CHECK_GL();
+            return JOBPRIORITY_URGENT;
+        }
 
-            glDeleteBuffers(1, &(pObj->mVertexBuffer));
-            CHECK_GL();
+        void Run(void)
+        {
+            pRenderer->FreeSlot(pObj->slot);
 
             delete pObj;
         }
@@ -150,7 +378,7 @@ void GroundRenderer::Set(const ChunkID id, GroundChunkRenderObj *p)
 
     if (mChunkRenderObjs.find(id) != mChunkRenderObjs.end())
     {
-        GroundChunkBufferDeleteJob deleteJob(mChunkRenderObjs.at(id));
+        GroundChunkBufferDeleteJob deleteJob(this, mChunkRenderObjs.at(id));
         deleteJob.Run();
 
         mChunkRenderObjs.erase(id);
@@ -158,67 +386,151 @@ void GroundRenderer::Set(const ChunkID id, GroundChunkRenderObj *p)
 
     mChunkRenderObjs.emplace(id, p);
 }
-void GroundRenderer::PrepareFor(const ChunkID id, const WorldSeed seed)
+/**
+ *  Where the renderer looked at the last frame.
+ */
+class GroundViewObserver: public ChunkObserver
+{
+    private:
+        vec3 position, direction;
+    public:
+        GroundViewObserver(const vec3 &pos, const vec3 &dir)
+        : position(pos), direction(dir)
+        {
+        }
+
+        vec3 GetWorldPosition(void) const
+        {
+            return position;
+        }
+
+        vec3 GetViewDirection(void) const
+        {
+            return direction;
+        }
+};
+float GroundRenderer::GetUploadPriority(const ChunkID id) const
+{
+    // Only called from the GL thread, like Render.
+    GroundViewObserver observer(mViewPosition, mViewDirection);
+
+    return GetPriority(id, &observer);
+}
+size_t GroundRenderer::GetLevel(const ChunkID id, const ChunkObserver *pObserver) const
+{
+    float cx, cz;
+    std::tie(cx, cz) = GetChunkCenter(id);
+
+    vec3 pos = pObserver->GetWorldPosition();
+    float distance = length(vec2(cx - pos.x, cz - pos.z));
+
+    size_t level = 0;
+    while (level < (COUNT_GROUND_LEVELS - 1) && distance > groundLevelDistances[level])
+        level++;
+
+    return level;
+}
+void GroundRenderer::PrepareFor(const ChunkID id, const size_t level, const WorldSeed seed)
 {
     GroundGenerator groundGenerator(seed);
 
     GroundChunkRenderObj *pObj = new GroundChunkRenderObj;
+    pObj->level = level;
+
+    const size_t n = CountGroundChunkRowPoints(level);
+    const float spacing = groundLevelSteps[level] * TILE_SIZE;
+
+    // Write the vertices straight into a staging slot if there is one, otherwise into memory.
+    // The slots are big enough for the finest level.
+    GroundRenderVertex *vertices;
+    std::unique_ptr<GroundRenderVertex[]> pVertices;
+    size_t stagingSlot;
+    void *pStaged;
+    if (staging && mStagingBuffer.Acquire(stagingSlot, pStaged))
+        vertices = (GroundRenderVertex *)pStaged;
+    else
+    {
+        pVertices.reset(new GroundRenderVertex[CountGroundChunkVertices(level)]);
+        vertices = pVertices.get();
+    }
 
-    float ox = (float(id.x) - 0.5f) * CHUNK_SIZE,
-          oz = (float(id.z) - 0.5f) * CHUNK_SIZE,
+    vec2 origin = GetGroundChunkOrigin(id);
+    float ox = origin.x,
+          oz = origin.y,
           x0, x_, x1, z0, z_, z1;
 
-    vec3 p_0, p10, p0_, p01, p00, t, b, n;
-    size_t ix, iz, i, indexCount = 0;
+    // Evaluate every height only once, the normals are taken from the neighbours in the grid.
+    // One extra row of points on each side, for calculating the normals at the edges.
+    std::unique_ptr<float[]> heights(new float[(n + 2) * (n + 2)]);
+    groundGenerator.GetVerticalCoords(vec2(ox - spacing, oz - spacing), spacing, n + 2, heights.get());
+
+    vec3 p_0, p10, p0_, p01, p00, t, b, normal;
+    size_t ix, iz, i;
+
+    pObj->minHeight = heights[GetOnHeightGridIndexFor(n, 0, 0)];
+    pObj->maxHeight = pObj->minHeight;
 
-    for (ix = 0; ix < COUNT_CHUNKROW_POINTS; ix++)
+    for (ix = 0; ix < n; ix++)
     {
-        x0 = ox + float(ix) * TILE_SIZE;
-        x_ = ox + float(ix - 1) * TILE_SIZE;
-        x1 = ox + float(ix + 1) * TILE_SIZE;
+        x0 = ox + float(ix) * spacing;
+        x_ = x0 - spacing;
+        x1 = x0 + spacing;
 
-        for (iz = 0; iz < COUNT_CHUNKROW_POINTS; iz++)
+        for (iz = 0; iz < n; iz++)
         {
-            z0 = oz + float(iz) * TILE_SIZE;
-            z_ = oz + float(iz - 1) * TILE_SIZE;
-            z1 = oz + float(iz + 1) * TILE_SIZE;
+            z0 = oz + float(iz) * spacing;
+            z_ = z0 - spacing;
+            z1 = z0 + spacing;
 
-            p00 = vec3(x0, groundGenerator.GetVerticalCoord(vec2(x0, z0)), z0);
-            p_0 = vec3(x_, groundGenerator.GetVerticalCoord(vec2(x_, z0)), z0);
-            p0_ = vec3(x0, groundGenerator.GetVerticalCoord(vec2(x0, z_)), z_);
-            p10 = vec3(x1, groundGenerator.GetVerticalCoord(vec2(x1, z0)), z0);
-            p01 = vec3(x0, groundGenerator.GetVerticalCoord(vec2(x0, z1)), z1);
+            p00 = vec3(x0, heights[GetOnHeightGridIndexFor(n, ix, iz)], z0);
+            p_0 = vec3(x_, heights[GetOnHeightGridIndexFor(n, ix - 1, iz)], z0);
+            p0_ = vec3(x0, heights[GetOnHeightGridIndexFor(n, ix, iz - 1)], z_);
+            p10 = vec3(x1, heights[GetOnHeightGridIndexFor(n, ix + 1, iz)], z0);
+            p01 = vec3(x0, heights[GetOnHeightGridIndexFor(n, ix, iz + 1)], z1);
 
             t = normalize(normalize(p00 - p_0) + normalize(p10 - p00));
             b = normalize(normalize(p00 - p01) + normalize(p0_ - p00));
-            n = cross(t, b);
+            normal = cross(t, b);
 
-            i = GetOnChunkIndexFor(ix, iz);
+            i = GetOnChunkIndexFor(n, ix, iz);
 
-            pObj->vertices[i].position = p00;
-            pObj->vertices[i].normal = n;
+            SetGroundRenderVertex(vertices[i], p00.y, normal);
 
-            if (ix < COUNT_CHUNKROW_TILES && iz < COUNT_CHUNKROW_TILES)
-            {
-                pObj->indices[indexCount + 0] = GetOnChunkIndexFor(ix, iz);
-                pObj->indices[indexCount + 1] = GetOnChunkIndexFor(ix, iz + 1);
-                pObj->indices[indexCount + 2] = GetOnChunkIndexFor(ix + 1, iz + 1);
-
-                pObj->indices[indexCount + 3] = GetOnChunkIndexFor(ix, iz);
-                pObj->indices[indexCount + 4] = GetOnChunkIndexFor(ix + 1, iz + 1);
-                pObj->indices[indexCount + 5] = GetOnChunkIndexFor(ix + 1, iz);
+            /*  The skirts copy the normals from the edge, so that they blend in.
+                They're set here, because the vertices may be in write-only mapped memory.
+             */
+            if (ix == 0 || ix == (n - 1))
+                SetGroundRenderVertex(vertices[GetOnChunkSkirtIndexFor(n, ix == 0 ? 0 : 1, iz)],
+                                      p00.y - GROUND_SKIRT_DEPTH, normal);
+            if (iz == 0 || iz == (n - 1))
+                SetGroundRenderVertex(vertices[GetOnChunkSkirtIndexFor(n, iz == 0 ? 2 : 3, ix)],
+                                      p00.y - GROUND_SKIRT_DEPTH, normal);
 
-                indexCount += 6;
-            }
+            pObj->minHeight = std::min(pObj->minHeight, p00.y);
+            pObj->maxHeight = std::max(pObj->maxHeight, p00.y);
         }
     }
 
-    App::Instance().PushGL(new GroundChunkBufferFillJob(this, id, pObj));
+    pObj->minHeight -= GROUND_SKIRT_DEPTH;
+
+    if (pVertices)
+        App::Instance().PushGL(new GroundChunkBufferFillJob(this, id, pObj, std::move(pVertices)));
+    else
+        App::Instance().PushGL(new GroundChunkBufferFillJob(this, id, pObj, stagingSlot));
+}
+GroundRenderer::GroundRenderer(const WorldSeed seed)
+: textureSeed(seed), staging(false), mViewPosition(0.0f, 0.0f, 0.0f), mViewDirection(0.0f, 0.0f, 0.0f),
+  timing(false), timerPending(false),
+  countDrawnIndices(0), countOccludedIndices(0),
+  countTimedDrawnIndices(0), countTimedOccludedIndices(0),
+  countOccludedChunks(0), drawMillis(0.0), savedMillis(0.0)
+{
 }
 GroundRenderer::~GroundRenderer(void)
 {
+    // The slots go with the vertex buffer.
     for (const auto &pair : mChunkRenderObjs)
-        DestroyFor(pair.first);
+        delete pair.second;
 }
 void GroundRenderer::DestroyFor(const ChunkID id)
 {
@@ -226,7 +538,7 @@ void GroundRenderer::DestroyFor(const ChunkID id)
 
     if (mChunkRenderObjs.find(id) != mChunkRenderObjs.end())
     {
-        App::Instance().PushGL(new GroundChunkBufferDeleteJob(mChunkRenderObjs.at(id)));
+        App::Instance().PushGL(new GroundChunkBufferDeleteJob(this, mChunkRenderObjs.at(id)));
 
         mChunkRenderObjs.erase(id);
     }
@@ -238,128 +550,376 @@ GLfloat GroundRenderer::GetWorkRadius(void) const
 
     return config.render.distance;
 }
-void GroundRenderer::TellInit(Queue &queue)
+/**
+ *  Enough for the chunks that can be at the given level within the radius.
+ *  Doubled, because a chunk's old level stays until its new level is uploaded.
+ */
+size_t CountGroundPoolSlots(const size_t level, const float radius)
 {
-    pTexture = App::Instance().GetGLManager()->AllocTexture();
-    queue.Add(new PNGTextureLoadJob("sand", *pTexture));
+    const float pi = 3.14159265f;
 
-    VertexAttributeMap attributes;
-    attributes["position"] = GROUND_POSITION_INDEX;
-    attributes["normal"] = GROUND_NORMAL_INDEX;
-    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
-    App::Instance().PushGL(new ShaderLoadJob(*pProgram, groundVertexShaderSrc, groundFragmentShaderSrc, attributes));
+    float limit = radius + CHUNK_SIZE,
+          inner = 0.0f,
+          outer = limit;
+
+    if (level > 0)
+        inner = std::min(limit, std::max(0.0f, groundLevelDistances[level - 1] - CHUNK_SIZE));
+    if (level < (COUNT_GROUND_LEVELS - 1))
+        outer = std::min(limit, groundLevelDistances[level] + CHUNK_SIZE);
+
+    if (outer <= inner)
+        return 0;
+
+    return 2 * size_t(std::ceil(pi * (outer * outer - inner * inner) / (CHUNK_SIZE * CHUNK_SIZE))) + 16;
 }
-void GroundRenderer::Render(const mat4 &projection, const mat4 &view, const vec3 &center,
-                            const vec4 &horizonColor, const vec3 &lightDirection)
+bool GroundRenderer::AllocSlot(const size_t level, size_t &slot)
 {
-    glUseProgram(*pProgram);
-    CHECK_GL();
+    // Coarse chunks fit in the slots of finer levels.
+    size_t pool = level + 1;
+    while (pool > 0)
+    {
+        pool--;
 
-    GLint projectionMatrixLocation,
-          viewMatrixLocation,
-          horizonColorLocation,
-          lightDirectionLocation,
-          horizonDistanceLocation;
+        if (!mFreeSlots[pool].empty())
+        {
+            slot = mFreeSlots[pool].back();
+            mFreeSlots[pool].pop_back();
+            return true;
+        }
+    }
 
-    GLfloat renderDistance = GetWorkRadius();
+    return false;
+}
+void GroundRenderer::FreeSlot(const size_t slot)
+{
+    size_t pool = 0;
+    while (slot >= size_t(mPoolFirstSlots[pool + 1]))
+        pool++;
+
+    mFreeSlots[pool].push_back(slot);
+}
+GLint GroundRenderer::GetSlotBaseVertex(const size_t slot) const
+{
+    size_t pool = 0;
+    while (slot >= size_t(mPoolFirstSlots[pool + 1]))
+        pool++;
+
+    return mPoolBases[pool] + (GLint(slot) - mPoolFirstSlots[pool]) * mPoolStrides[pool];
+}
+void GroundRenderer::SetChunkData(const size_t slot, const ChunkID id, const size_t level)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    vec2 origin = GetGroundChunkOrigin(id);
+    vec4 data(origin.x, origin.y, groundLevelSteps[level] * TILE_SIZE, float(CountGroundChunkRowPoints(level)));
 
-    projectionMatrixLocation = glGetUniformLocation(*pProgram, "projectionMatrix");
+    pState->BindBuffer(GL_TEXTURE_BUFFER, *pChunkDataBuffer);
+
+    glBufferSubData(GL_TEXTURE_BUFFER, slot * sizeof(vec4), sizeof(vec4), value_ptr(data));
     CHECK_GL();
-    CHECK_UNIFORM_LOCATION(projectionMatrixLocation);
 
-    viewMatrixLocation = glGetUniformLocation(*pProgram, "viewMatrix");
+    pState->BindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+// Enough for the workers to keep going while the GL thread is busy.
+#define COUNT_GROUND_STAGING_SLOTS 32
+void GroundRenderer::TellInit(Queue &queue)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    staging = mStagingBuffer.Init(GROUND_MAX_VERTEXBUFFER_SIZE, COUNT_GROUND_STAGING_SLOTS);
+
+    size_t level, countIndices = 0, countSlots, slot;
+    for (level = 0; level < COUNT_GROUND_LEVELS; level++)
+    {
+        mIndexOffsets[level] = countIndices * sizeof(GroundRenderIndex);
+        countIndices += CountGroundChunkIndices(level);
+    }
+
+    std::unique_ptr<GroundRenderIndex[]> indices(new GroundRenderIndex[countIndices]);
+    for (level = 0; level < COUNT_GROUND_LEVELS; level++)
+        FillGroundChunkIndices(level, indices.get() + mIndexOffsets[level] / sizeof(GroundRenderIndex));
+
+    // Divide the vertex buffer in pools.
+    float radius = GetWorkRadius();
+    mPoolBases[0] = 0;
+    mPoolFirstSlots[0] = 0;
+    for (level = 0; level < COUNT_GROUND_LEVELS; level++)
+    {
+        countSlots = CountGroundPoolSlots(level, radius);
+
+        mPoolStrides[level] = CountGroundChunkVertices(level);
+        mPoolBases[level + 1] = mPoolBases[level] + countSlots * mPoolStrides[level];
+        mPoolFirstSlots[level + 1] = mPoolFirstSlots[level] + countSlots;
+
+        mFreeSlots[level].clear();
+        for (slot = mPoolFirstSlots[level + 1]; slot > size_t(mPoolFirstSlots[level]); slot--)
+            mFreeSlots[level].push_back(slot - 1);
+    }
+
+    pIndexBuffer = App::Instance().GetGLManager()->AllocBuffer();
+    pVertexBuffer = App::Instance().GetGLManager()->AllocBuffer();
+    pChunkDataBuffer = App::Instance().GetGLManager()->AllocBuffer();
+    pChunkDataTexture = App::Instance().GetGLManager()->AllocTexture();
+    pVertexArray = App::Instance().GetGLManager()->AllocVertexArray();
+
+    pState->BindBuffer(GL_TEXTURE_BUFFER, *pChunkDataBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, mPoolFirstSlots[COUNT_GROUND_LEVELS] * sizeof(vec4), NULL, GL_DYNAMIC_DRAW);
     CHECK_GL();
-    CHECK_UNIFORM_LOCATION(viewMatrixLocation);
+    pState->BindBuffer(GL_TEXTURE_BUFFER, 0);
 
-    horizonColorLocation = glGetUniformLocation(*pProgram, "horizonColor");
+    glBindTexture(GL_TEXTURE_BUFFER, *pChunkDataTexture);
+    CHECK_GL();
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, *pChunkDataBuffer);
     CHECK_GL();
-    CHECK_UNIFORM_LOCATION(horizonColorLocation);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    CHECK_GL();
+
+    // The vertex array doesn't change after this.
+    pState->BindVertexArray(*pVertexArray);
 
-    lightDirectionLocation = glGetUniformLocation(*pProgram, "lightDirection");
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, countIndices * sizeof(GroundRenderIndex), indices.get(), GL_STATIC_DRAW);
     CHECK_GL();
-    CHECK_UNIFORM_LOCATION(lightDirectionLocation);
 
-    horizonDistanceLocation =  glGetUniformLocation(*pProgram, "horizonDistance");
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mPoolBases[COUNT_GROUND_LEVELS] * sizeof(GroundRenderVertex), NULL, GL_STATIC_DRAW);
     CHECK_GL();
-    CHECK_UNIFORM_LOCATION(horizonDistanceLocation);
 
-    glUniformMatrix4fv(projectionMatrixLocation, 1, GL_FALSE, value_ptr(projection));
+    // Height
+    glEnableVertexAttribArray(GROUND_HEIGHT_INDEX);
+    CHECK_GL();
+    glVertexAttribPointer(GROUND_HEIGHT_INDEX, 1, GL_SHORT, GL_FALSE, sizeof(GroundRenderVertex), 0);
     CHECK_GL();
 
-    glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, value_ptr(view));
+    // Normal
+    glEnableVertexAttribArray(GROUND_NORMAL_INDEX);
+    CHECK_GL();
+    glVertexAttribPointer(GROUND_NORMAL_INDEX, 2, GL_BYTE, GL_TRUE, sizeof(GroundRenderVertex), (GLvoid *)sizeof(GLshort));
     CHECK_GL();
 
-    glUniform4fv(horizonColorLocation, 1, value_ptr(horizonColor));
+    pState->BindVertexArray(0);
+    pState->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Every chunk that has a slot might have to be tested.
+    mOcclusionCuller.Init(mPoolFirstSlots[COUNT_GROUND_LEVELS]);
+
+    timing = GLEW_ARB_timer_query;
+    if (timing)
+        pTimerQuery = App::Instance().GetGLManager()->AllocQuery();
+
+    pTexture = App::Instance().GetGLManager()->AllocTexture();
+    TellSynthesizeSandTexture(queue, textureSeed, *pTexture);
+
+    VertexAttributeMap attributes;
+    attributes["height"] = GROUND_HEIGHT_INDEX;
+    attributes["normal"] = GROUND_NORMAL_INDEX;
+    UniformBlockBindingMap blocks;
+    blocks[FRAME_UNIFORM_BLOCK_NAME] = FRAME_UNIFORMS_BINDING;
+    mProgram.Alloc();
+    App::Instance().PushGL(new ShaderLoadJob(mProgram, groundVertexShaderSrc, groundFragmentShaderSrc, attributes, blocks));
+}
+void GroundRenderer::Render(const mat4 &projection, const mat4 &view, const vec3 &center)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    if (staging)
+        mStagingBuffer.Recycle();
+
+    mProgram.Use();
+
+    GLint poolBasesLocation,
+          poolFirstSlotsLocation,
+          poolStridesLocation,
+          chunkDataLocation;
+
+    GLfloat renderDistance = GetWorkRadius();
+
+    // The view matrix's third row is minus the view direction.
+    mViewPosition = center;
+    mViewDirection = -vec3(view[0][2], view[1][2], view[2][2]);
+
+    poolBasesLocation = mProgram.GetUniformLocation("poolBases");
+
+    poolFirstSlotsLocation = mProgram.GetUniformLocation("poolFirstSlots");
+
+    poolStridesLocation = mProgram.GetUniformLocation("poolStrides");
+
+    chunkDataLocation = mProgram.GetUniformLocation("chunkData");
+
+    glUniform1iv(poolBasesLocation, COUNT_GROUND_LEVELS + 1, mPoolBases);
     CHECK_GL();
 
-    glUniform3fv(lightDirectionLocation, 1, value_ptr(lightDirection));
+    glUniform1iv(poolFirstSlotsLocation, COUNT_GROUND_LEVELS + 1, mPoolFirstSlots);
     CHECK_GL();
 
-    glUniform1f(horizonDistanceLocation, renderDistance);
+    glUniform1iv(poolStridesLocation, COUNT_GROUND_LEVELS, mPoolStrides);
     CHECK_GL();
 
-    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(chunkDataLocation, 1);
     CHECK_GL();
 
-    glBindTexture(GL_TEXTURE_2D, *pTexture);
+    glActiveTexture(GL_TEXTURE1);
     CHECK_GL();
 
-    glEnable(GL_CULL_FACE);
+    glBindTexture(GL_TEXTURE_BUFFER, *pChunkDataTexture);
     CHECK_GL();
 
-    glDepthMask(GL_TRUE);
+    glActiveTexture(GL_TEXTURE0);
     CHECK_GL();
 
-    glEnable(GL_DEPTH_TEST);
+    glBindTexture(GL_TEXTURE_2D, *pTexture);
     CHECK_GL();
 
-    float x, z, dx, dz;
-    for (x = center.x - renderDistance; x < (center.x + renderDistance); x += CHUNK_SIZE)
+    pState->Enable(GL_CULL_FACE);
+
+    pState->DepthMask(GL_TRUE);
+
+    pState->Enable(GL_DEPTH_TEST);
+
+    // Results from an earlier frame.
+    size_t i;
+    if (mOcclusionCuller.Collect(mOcclusionVisible))
     {
-        for (z = center.z - renderDistance; z < (center.z + renderDistance); z += CHUNK_SIZE)
+        mOccludedChunks.clear();
+        for (i = 0; i < mOcclusionVisible.size(); i++)
         {
-            dx = x - center.x;
-            dz = z - center.z;
-            if ((dx * dx + dz * dz) <= renderDistance * renderDistance)
-            {
-                ChunkID id = GetChunkID(x, z);
+            if (!mOcclusionVisible[i])
+                mOccludedChunks.insert(mOcclusionTestIDs[i]);
+        }
+    }
+
+    if (timerPending)
+    {
+        GLint available;
+        glGetQueryObjectiv(*pTimerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        CHECK_GL();
+
+        if (available)
+        {
+            GLuint64 nanoseconds;
+            glGetQueryObjectui64v(*pTimerQuery, GL_QUERY_RESULT, &nanoseconds);
+            CHECK_GL();
+
+            drawMillis = double(nanoseconds) / 1.0e6;
+            if (countTimedDrawnIndices > 0)
+                savedMillis = drawMillis * countTimedOccludedIndices / countTimedDrawnIndices;
+            timerPending = false;
+        }
+    }
+
+    mCullIDs.clear();
+    mCullObjs.clear();
+    mCullBoxes.Clear();
+    mOcclusionBoxes.Clear();
+    mOcclusionFrameIDs.clear();
+    mDrawCounts.clear();
+    mDrawIndices.clear();
+    mDrawBaseVertices.clear();
+    {
+        std::scoped_lock lock(mtxChunkRenderObjs);
 
-                std::scoped_lock lock(mtxChunkRenderObjs);
+        float cx, cz, dx, dz;
+        vec2 origin;
+        for (const auto &pair : mChunkRenderObjs)
+        {
+            std::tie(cx, cz) = GetChunkCenter(pair.first);
+            dx = cx - center.x;
+            dz = cz - center.z;
+            if ((dx * dx + dz * dz) > renderDistance * renderDistance)
+                continue;
+
+            const GroundChunkRenderObj *pObj = pair.second;
+
+            origin = GetGroundChunkOrigin(pair.first);
+            mCullIDs.push_back(pair.first);
+            mCullObjs.push_back(pObj);
+            mCullBoxes.Add(vec3(origin.x, pObj->minHeight, origin.y),
+                           vec3(origin.x + CHUNK_SIZE, pObj->maxHeight, origin.y + CHUNK_SIZE));
+        }
 
-                if (mChunkRenderObjs.find(id) != mChunkRenderObjs.end())
-                {
-                    glBindBuffer(GL_ARRAY_BUFFER, mChunkRenderObjs.at(id)->mVertexBuffer);
-                    CHECK_GL();
+        // Render objects are only deleted in this thread, so the pointers stay valid after unlocking.
+    }
 
-                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mChunkRenderObjs.at(id)->mIndexBuffer);
-                    CHECK_GL();
+    Frustum frustum(projection * view);
+    mCullVisible.resize(mCullObjs.size());
+    frustum.CullBoxes(mCullBoxes, mCullVisible.data());
 
-                    // Position
-                    glEnableVertexAttribArray(GROUND_POSITION_INDEX);
-                    CHECK_GL();
-                    glVertexAttribPointer(GROUND_POSITION_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(GroundRenderVertex), 0);
-                    CHECK_GL();
+    // Everything in the frustum gets tested for occlusion again, including what's hidden now.
+    vec3 boxMin, boxMax;
+    countDrawnIndices = 0;
+    countOccludedIndices = 0;
+    countOccludedChunks = 0;
+    for (i = 0; i < mCullObjs.size(); i++)
+    {
+        if (!mCullVisible[i])
+            continue;
 
-                    // Normal
-                    glEnableVertexAttribArray(GROUND_NORMAL_INDEX);
-                    CHECK_GL();
-                    glVertexAttribPointer(GROUND_NORMAL_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(GroundRenderVertex), (GLvoid *)sizeof(vec3));
-                    CHECK_GL();
+        const GroundChunkRenderObj *pObj = mCullObjs[i];
 
-                    glDrawElements(GL_TRIANGLES, COUNT_GROUND_CHUNKRENDER_INDICES, GL_UNSIGNED_INT, 0);
-                    CHECK_GL();
-                }
-            }
+        mCullBoxes.Get(i, boxMin, boxMax);
+        mOcclusionBoxes.Add(boxMin, boxMax);
+        mOcclusionFrameIDs.push_back(mCullIDs[i]);
+
+        if (mOccludedChunks.find(mCullIDs[i]) != mOccludedChunks.end())
+        {
+            countOccludedChunks++;
+            countOccludedIndices += CountGroundChunkIndices(pObj->level);
+            continue;
         }
+        countDrawnIndices += CountGroundChunkIndices(pObj->level);
+
+        mDrawCounts.push_back(CountGroundChunkIndices(pObj->level));
+        mDrawIndices.push_back((const GLvoid *)mIndexOffsets[pObj->level]);
+        mDrawBaseVertices.push_back(GetSlotBaseVertex(pObj->slot));
+    }
+
+    pState->BindVertexArray(*pVertexArray);
+
+    bool timed = timing && !timerPending;
+    if (timed)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, *pTimerQuery);
+        CHECK_GL();
     }
 
-    glDisableVertexAttribArray(GROUND_POSITION_INDEX);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, mDrawCounts.data(), GL_UNSIGNED_INT, mDrawIndices.data(),
+                                  mDrawCounts.size(), mDrawBaseVertices.data());
     CHECK_GL();
-    glDisableVertexAttribArray(GROUND_NORMAL_INDEX);
+
+    if (timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        CHECK_GL();
+
+        timerPending = true;
+        countTimedDrawnIndices = countDrawnIndices;
+        countTimedOccludedIndices = countOccludedIndices;
+    }
+
+    pState->BindVertexArray(0);
+
+    glActiveTexture(GL_TEXTURE1);
     CHECK_GL();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
     CHECK_GL();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0);
     CHECK_GL();
+
+    // The depth of the drawn chunks decides what gets drawn next time.
+    if (mOcclusionCuller.Test(projection * view, mOcclusionBoxes))
+        mOcclusionTestIDs.swap(mOcclusionFrameIDs);
+}
+size_t GroundRenderer::CountOccludedChunks(void) const
+{
+    return countOccludedChunks;
+}
+double GroundRenderer::GetDrawMillis(void) const
+{
+    return drawMillis;
+}
+double GroundRenderer::GetOcclusionSavedMillis(void) const
+{
+    return savedMillis;
 }
@@ -2,6 +2,8 @@
 #define GROUND_HPP
 
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <glm/glm.hpp>
 using namespace glm;
@@ -11,37 +13,71 @@ using namespace glm;
 #include "load.hpp"
 #include "alloc.hpp"
 #include "chunk.hpp"
+#include "cull.hpp"
+#include "occlusion.hpp"
 
 
 class GroundGenerator
 {
     private:
         PerlinNoiseGenerator2D mNoiseGenerator;
+        Octaves mOctaves;
     public:
         GroundGenerator(const WorldSeed);
 
         float GetVerticalCoord(const vec2 &coords) const;
+
+        /**
+         *  Fills a count x count grid at once: heights[ix * count + iz] is set to
+         *  the vertical coord at origin + spacing * (ix, iz).
+         */
+        void GetVerticalCoords(const vec2 &origin, const float spacing, const size_t count, float *heights) const;
 };
 
+// Heights are stored as multiples of this.
+#define GROUND_HEIGHT_UNIT (1.0f / 512)
+
+/**
+ *  Only 4 bytes, the shader calculates the x and z coords from the vertex index,
+ *  the chunk origin and the tile size.
+ */
 struct GroundRenderVertex
 {
-    vec3 position,
-         normal;
+    GLshort height;
+    GLbyte normal[2];  // octahedral encoded
 };
 typedef unsigned int GroundRenderIndex;
 
-#define COUNT_CHUNKROW_POINTS (COUNT_CHUNKROW_TILES + 1)
-#define COUNT_GROUND_CHUNKRENDER_INDICES (6 * COUNT_CHUNKROW_TILES * COUNT_CHUNKROW_TILES)
-#define COUNT_GROUND_CHUNKRENDER_VERTICES (COUNT_CHUNKROW_POINTS * COUNT_CHUNKROW_POINTS)
-
+/**
+ *  Levels of detail: at level i, a chunk row has COUNT_CHUNKROW_TILES / groundLevelSteps[i] tiles.
+ *  A chunk goes to the next level beyond groundLevelDistances[i] from the observer.
+ */
+#define COUNT_GROUND_LEVELS 6
+extern const size_t groundLevelSteps[COUNT_GROUND_LEVELS];
+extern const float groundLevelDistances[COUNT_GROUND_LEVELS - 1];
+
+/**
+ *  Each edge has a skirt hanging down, so that the cracks between chunks
+ *  at different levels are covered.
+ */
+#define GROUND_SKIRT_DEPTH 5.0f
+
+size_t CountGroundChunkRowPoints(const size_t level);
+size_t CountGroundChunkVertices(const size_t level);
+size_t CountGroundChunkIndices(const size_t level);
+
+/**
+ *  The vertices don't stay in memory, they go straight to a slot in the renderer's vertex buffer.
+ *  All chunks at the same level have the same topology, so they share their indices.
+ */
 struct GroundChunkRenderObj
 {
-    GroundRenderVertex vertices[COUNT_GROUND_CHUNKRENDER_VERTICES];
-    GroundRenderIndex indices[COUNT_GROUND_CHUNKRENDER_INDICES];
+    size_t level,
+           slot;
 
-    // Don't use GLRef here, because we want to release the buffers immediatly as the chunks are unloaded.
-    GLuint mVertexBuffer,
-           mIndexBuffer;
+    // Including the skirts.
+    float minHeight,
+          maxHeight;
 };
 
 class GroundRenderer: public Initializable, public ChunkWorker
@@ -52,24 +88,87 @@ class GroundRenderer: public Initializable, public ChunkWorker
         // Not using unique_ptr here, because a render object can only be deleted in the GL thread.
         std::unordered_map<ChunkID, GroundChunkRenderObj *> mChunkRenderObjs;
 
-        GLRef pProgram,
-              pTexture;
+        ShaderProgram mProgram;
+        WorldSeed textureSeed;
+        GLRef pTexture,
+              pIndexBuffer,      // the indices of all levels, one after the other
+              pVertexBuffer,     // the vertices of all chunks, in slots
+              pChunkDataBuffer,  // per slot: origin, tile size and row points
+              pChunkDataTexture,
+              pVertexArray;
+
+        GLintptr mIndexOffsets[COUNT_GROUND_LEVELS];
+
+        /**
+         *  The vertex buffer is divided in pools, the slots in pool i are big enough for level i.
+         *  Slots are numbered through all pools. Only used in the GL thread.
+         */
+        GLint mPoolBases[COUNT_GROUND_LEVELS + 1],
+              mPoolFirstSlots[COUNT_GROUND_LEVELS + 1],
+              mPoolStrides[COUNT_GROUND_LEVELS];
+        std::vector<size_t> mFreeSlots[COUNT_GROUND_LEVELS];
+
+        bool AllocSlot(const size_t level, size_t &slot);
+        void FreeSlot(const size_t slot);
+        GLint GetSlotBaseVertex(const size_t slot) const;
+        void SetChunkData(const size_t slot, const ChunkID, const size_t level);
+
+        // Rebuilt every frame, kept to save allocations.
+        std::vector<ChunkID> mCullIDs;
+        std::vector<const GroundChunkRenderObj *> mCullObjs;
+        BoundingBoxes mCullBoxes, mOcclusionBoxes;
+        std::vector<uint8_t> mCullVisible, mOcclusionVisible;
+        std::vector<GLsizei> mDrawCounts;
+        std::vector<const GLvoid *> mDrawIndices;
+        std::vector<GLint> mDrawBaseVertices;
+
+        // Where the workers write the vertices to, if the GL supports it.
+        StagingBuffer mStagingBuffer;
+        bool staging;
+
+        vec3 mViewPosition,
+             mViewDirection;
 
         void Set(const ChunkID, GroundChunkRenderObj *);
+
+        // Chunks that were hidden behind others at the last occlusion test.
+        OcclusionCuller mOcclusionCuller;
+        std::vector<ChunkID> mOcclusionTestIDs,   // in the order of the pending test
+                             mOcclusionFrameIDs;
+        std::unordered_set<ChunkID> mOccludedChunks;
+
+        // Times the draw call, if the GL supports it.
+        GLRef pTimerQuery;
+        bool timing, timerPending;
+        size_t countDrawnIndices, countOccludedIndices,
+               countTimedDrawnIndices, countTimedOccludedIndices,
+               countOccludedChunks;
+        double drawMillis, savedMillis;
+
+        // For uploading the chunks in view first.
+        float GetUploadPriority(const ChunkID) const;
     public:
+        GroundRenderer(const WorldSeed textureSeed);
         ~GroundRenderer(void);
 
         void TellInit(Queue &);
 
-        void Render(const mat4 &projection, const mat4 &view, const vec3 &center,
-                    const vec4 &horizonColor, const vec3 &lightDirection);
+        // The frame uniforms must be set, the arguments are for culling.
+        void Render(const mat4 &projection, const mat4 &view, const vec3 &center);
+
+        // Statistics of the last frames.
+        size_t CountOccludedChunks(void) const;
+        double GetDrawMillis(void) const;
+        double GetOcclusionSavedMillis(void) const;  // estimated from the draw time per index
 
-        void PrepareFor(const ChunkID, const WorldSeed);
+        void PrepareFor(const ChunkID, const size_t level, const WorldSeed);
         void DestroyFor(const ChunkID);
         float GetWorkRadius(void) const;
+        size_t GetLevel(const ChunkID, const ChunkObserver *) const;
 
     friend class GroundChunkRenderLoadJob;
     friend class GroundChunkBufferFillJob;
+    friend class GroundChunkBufferDeleteJob;
 };
 
 #endif  // GROUND_HPP
@@ -0,0 +1,242 @@
+/**
+ *  Checks what the occlusion culler keeps and hides, around a wall on the left half of the view:
+ *
+ *      hiztest
+ *
+ *  Runs without a display with SDL_VIDEODRIVER=offscreen, on the cpu with LIBGL_ALWAYS_SOFTWARE=1.
+ *  The wall is drawn in framebuffers of several depth formats, single sampled and multisampled.
+ *  Returns 1 if any box comes out wrong.
+ */
+
+#include <iostream>
+#include <thread>
+#include <cstdint>
+
+#include <boost/format.hpp>
+
+#include "app.hpp"
+#include "occlusion.hpp"
+#include "shader.hpp"
+#include "error.hpp"
+
+
+#define HIZTEST_SIZE 64
+
+// In pixels from the left, so that the column of pixels 31 is half covered.
+#define HIZTEST_WALL_EDGE 31.6f
+
+const char wallVertexShaderSrc[] = R"shader(
+#version 150
+
+uniform float right;
+
+void main()
+{
+    gl_Position = vec4((gl_VertexID & 1) != 0 ? right : -1.0, (gl_VertexID & 2) != 0 ? 1.0 : -1.0, 0.0, 1.0);
+}
+)shader";
+
+const char wallFragmentShaderSrc[] = R"shader(
+#version 150
+
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = vec4(1.0);
+}
+)shader";
+
+struct HiZTestFrameBuffer
+{
+    const char *name;
+    GLenum depthFormat;
+    GLsizei countSamples;
+};
+const HiZTestFrameBuffer hiZTestFrameBuffers[] = {
+    {"D24S8", GL_DEPTH24_STENCIL8, 0},
+    {"D24", GL_DEPTH_COMPONENT24, 0},
+    {"D24S8 4x", GL_DEPTH24_STENCIL8, 4},
+    {"D32F 4x", GL_DEPTH_COMPONENT32F, 4}
+};
+
+/**
+ *  The projection is the identity, so that world coordinates are device coordinates.
+ *  The wall is at depth 0.5, 0.0 in device coordinates.
+ */
+struct HiZTestBox
+{
+    const char *name;
+    vec3 min, max;
+    bool visible,
+         multisampledOnly;  // single sampled, the pixel is the wall's
+};
+float PixelToDevice(const float pixel)
+{
+    return 2.0f * pixel / HIZTEST_SIZE - 1.0f;
+}
+const HiZTestBox hiZTestBoxes[] = {
+    {"behind the wall", vec3(PixelToDevice(4), PixelToDevice(4), 0.5f), vec3(PixelToDevice(12), PixelToDevice(12), 0.6f), false, false},
+    {"before the wall", vec3(PixelToDevice(4), PixelToDevice(4), -0.6f), vec3(PixelToDevice(12), PixelToDevice(12), -0.5f), true, false},
+    {"beside the wall", vec3(PixelToDevice(40), PixelToDevice(4), 0.5f), vec3(PixelToDevice(56), PixelToDevice(12), 0.6f), true, false},
+    {"behind the wall's edge", vec3(PixelToDevice(31.7f), PixelToDevice(4), 0.5f), vec3(PixelToDevice(31.9f), PixelToDevice(12), 0.6f), true, true}
+};
+
+size_t CountWrongBoxes(OcclusionCuller &culler, const ShaderProgram &wallProgram, const HiZTestFrameBuffer &test)
+{
+    GLManager *pManager = App::Instance().GetGLManager();
+    GLState *pState = App::Instance().GetGLState();
+
+    GLRef pDepthTexture = pManager->AllocTexture(),
+          pFrameBuffer = pManager->AllocFrameBuffer(),
+          pVertexArray = pManager->AllocVertexArray();
+
+    GLenum target = test.countSamples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    glBindTexture(target, *pDepthTexture);
+    CHECK_GL();
+    if (test.countSamples > 0)
+        glTexImage2DMultisample(target, test.countSamples, test.depthFormat, HIZTEST_SIZE, HIZTEST_SIZE, GL_TRUE);
+    else
+        glTexImage2D(target, 0, test.depthFormat, HIZTEST_SIZE, HIZTEST_SIZE, 0,
+                     test.depthFormat == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT,
+                     test.depthFormat == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 : GL_UNSIGNED_INT, NULL);
+    CHECK_GL();
+    glBindTexture(target, 0);
+    CHECK_GL();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, *pFrameBuffer);
+    CHECK_GL();
+    glFramebufferTexture2D(GL_FRAMEBUFFER,
+                           test.depthFormat == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                           target, *pDepthTexture, 0);
+    CHECK_GL();
+    glDrawBuffer(GL_NONE);
+    CHECK_GL();
+    glReadBuffer(GL_NONE);
+    CHECK_GL();
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    CHECK_GL();
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        throw GLError("%s framebuffer incomplete: 0x%x", test.name, status);
+
+    glViewport(0, 0, HIZTEST_SIZE, HIZTEST_SIZE);
+    CHECK_GL();
+
+    pState->Enable(GL_DEPTH_TEST);
+    pState->DepthMask(GL_TRUE);
+
+    glClearDepth(1.0f);
+    CHECK_GL();
+    glClear(GL_DEPTH_BUFFER_BIT);
+    CHECK_GL();
+
+    wallProgram.Use();
+    glUniform1f(wallProgram.GetUniformLocation("right"), PixelToDevice(HIZTEST_WALL_EDGE));
+    CHECK_GL();
+
+    pState->BindVertexArray(*pVertexArray);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    CHECK_GL();
+    pState->BindVertexArray(0);
+
+    BoundingBoxes boxes;
+    for (const HiZTestBox &box : hiZTestBoxes)
+        boxes.Add(box.min, box.max);
+
+    if (!culler.Test(mat4(1.0f), boxes))
+        throw RuntimeError("%s: the culler didn't test", test.name);
+
+    glFinish();
+    CHECK_GL();
+
+    std::vector<uint8_t> visible;
+    while (!culler.Collect(visible))
+        std::this_thread::yield();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    CHECK_GL();
+
+    size_t i, countWrong = 0;
+    for (i = 0; i < boxes.Size(); i++)
+    {
+        const HiZTestBox &box = hiZTestBoxes[i];
+        if (box.multisampledOnly && test.countSamples <= 0)
+            continue;
+
+        bool ok = bool(visible[i]) == box.visible;
+        if (!ok)
+            countWrong++;
+
+        std::cout << boost::format("%-9s %-23s %-7s %s") % test.name % box.name
+                                                         % (visible[i] ? "kept" : "culled")
+                                                         % (ok ? "ok" : "WRONG") << std::endl;
+    }
+
+    return countWrong;
+}
+
+int main(int argc, char **argv)
+{
+    App::Instance().exePath = argv[0];
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    {
+        std::cerr << "Unable to initialize SDL: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+
+    SDL_Window *pWindow = SDL_CreateWindow("hiztest", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                           HIZTEST_SIZE, HIZTEST_SIZE, SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL);
+    SDL_GLContext context = pWindow != NULL ? SDL_GL_CreateContext(pWindow) : NULL;
+    if (context == NULL)
+    {
+        std::cerr << "Failed to create GL context: " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return 1;
+    }
+
+    size_t countWrong = 0;
+    try
+    {
+        GLenum err = glewInit();
+        if (GLEW_OK != err)
+            throw InitError("glewInit failed: %s", glewGetErrorString(err));
+
+        if (!GLEW_VERSION_3_2)
+            throw InitError("OpenGL version 3.2 is not enabled.");
+
+        std::cout << glGetString(GL_RENDERER) << std::endl;
+
+        // The jobs that are pushed here, must run here.
+        App::Instance().glThreadID = std::this_thread::get_id();
+
+        OcclusionCuller culler;
+        culler.Init(sizeof(hiZTestBoxes) / sizeof(HiZTestBox));
+
+        ShaderProgram wallProgram;
+        wallProgram.Alloc();
+        App::Instance().PushGL(new ShaderLoadJob(wallProgram, wallVertexShaderSrc, wallFragmentShaderSrc,
+                                                 VertexAttributeMap()));
+        while (App::Instance().CountPendingGL() > 0)
+            App::Instance().mGLJobRunner.WorkFrom(App::Instance().mGLQueue, 1000.0, SIZE_MAX);
+
+        for (const HiZTestFrameBuffer &test : hiZTestFrameBuffers)
+            countWrong += CountWrongBoxes(culler, wallProgram, test);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        countWrong++;
+    }
+
+    App::Instance().GetGLManager()->DestroyAll();
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(pWindow);
+    SDL_Quit();
+
+    return countWrong > 0 ? 1 : 0;
+}
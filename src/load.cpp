@@ -1,4 +1,7 @@
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -13,7 +16,7 @@ using namespace glm;
 
 void WorkThreadFunc(Queue &queue, ErrorManager &errorManager)
 {
-    std::shared_ptr<Job> pJob;
+    std::unique_ptr<Job> pJob;
     while ((pJob = queue.Take()) != NULL)
     {
         try
@@ -28,7 +31,7 @@ void WorkThreadFunc(Queue &queue, ErrorManager &errorManager)
 }
 void WorkAllFrom(Queue &queue)
 {
-    std::shared_ptr<Job> pJob;
+    std::unique_ptr<Job> pJob;
     while ((pJob = queue.Take()) != NULL)
         pJob->Run();
 }
@@ -36,32 +39,58 @@ void ClearAllFrom(Queue &queue)
 {
     while (queue.Take() != NULL);
 }
-size_t Queue::Size(void)
+size_t BudgetedJobRunner::WorkFrom(Queue &queue, const double maxMillis, const size_t maxBytes)
 {
-    std::scoped_lock lock(mtxJobs);
-    return mJobs.size();
+    std::unique_ptr<Job> pJob;
+    while ((pJob = queue.Take()) != NULL)
+        mPending.push_back({JOBPRIORITY_NORMAL, std::move(pJob)});
+
+    for (std::unique_ptr<Job> &pAdded : mAdded)
+        mPending.push_back({JOBPRIORITY_NORMAL, std::move(pAdded)});
+    mAdded.clear();
+
+    // Priorities may have changed since the last frame.
+    for (PendingJob &pending : mPending)
+        pending.priority = pending.pJob->GetPriority();
+
+    std::stable_sort(mPending.begin(), mPending.end(),
+                     [](const PendingJob &a, const PendingJob &b) { return a.priority < b.priority; });
+
+    std::chrono::time_point<std::chrono::steady_clock> startTime = std::chrono::steady_clock::now();
+    double millis;
+    size_t countRun = 0, bytes = 0, size;
+
+    while (mPending.size() > 0)
+    {
+        millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        size = mPending.front().pJob->GetUploadSize();
+
+        if (countRun > 0 && (millis >= maxMillis || (bytes + size) > maxBytes))
+            break;
+
+        pJob = std::move(mPending.front().pJob);
+        mPending.pop_front();
+
+        pJob->Run();
+
+        bytes += size;
+        countRun++;
+    }
+
+    return mPending.size();
 }
-void Queue::Add(Job *pJob)
+void BudgetedJobRunner::Add(std::unique_ptr<Job> pJob)
 {
-    Add(std::shared_ptr<Job>(pJob));
+    mAdded.push_back(std::move(pJob));
 }
-void Queue::Add(std::shared_ptr<Job> pJob)
+void BudgetedJobRunner::Clear(void)
 {
-    std::scoped_lock lock(mtxJobs);
-    mJobs.push_back(pJob);
+    mPending.clear();
+    mAdded.clear();
 }
-std::shared_ptr<Job> Queue::Take(void)
+size_t BudgetedJobRunner::CountPending(void) const
 {
-    std::shared_ptr<Job> pJob;
-    std::scoped_lock lock(mtxJobs);
-    if (mJobs.size() > 0)
-    {
-        pJob = mJobs.front();
-        mJobs.pop_front();
-        return pJob;
-    }
-    else
-        return NULL;
+    return mPending.size() + mAdded.size();
 }
 void ErrorManager::PushError(const std::exception_ptr &e)
 {
@@ -168,23 +197,26 @@ void main()
 LoadScene::LoadScene(InitializableScene *p)
 : pLoaded(p)
 {
+    GLState *pState = App::Instance().GetGLState();
+
     pLoaded->TellInit(mQueue);
 
-    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
+    mProgram.Alloc();
     VertexAttributeMap attributes;
     attributes["position"] = LOAD_POSITON_INDEX;
-    ShaderLoadJob job(*pProgram, loadVertexShaderSrc,
+    ShaderLoadJob job(mProgram, loadVertexShaderSrc,
                                  loadGeometryShaderSrc,
                                  loadFragmentShaderSrc, attributes);
-    job.Run();
+
+    // Needed for the very first frame.
+    job.RunNow();
 
 
     const static GLfloat line[] = {-0.8f, 0.0f, 0.8f, 0.0f};
 
     pBuffer = App::Instance().GetGLManager()->AllocBuffer();
 
-    glBindBuffer(GL_ARRAY_BUFFER, *pBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pBuffer);
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(line), line, GL_STATIC_DRAW);
     CHECK_GL();
@@ -218,28 +250,24 @@ void LoadScene::InterruptLoading(void)
 }
 void LoadScene::Render(void)
 {
+    GLState *pState = App::Instance().GetGLState();
+
     glClear(GL_COLOR_BUFFER_BIT);
     CHECK_GL();
 
-    glDisable(GL_CULL_FACE);
-    CHECK_GL();
+    pState->Disable(GL_CULL_FACE);
 
-    glDisable(GL_DEPTH_TEST);
-    CHECK_GL();
+    pState->Disable(GL_DEPTH_TEST);
 
-    glUseProgram(*pProgram);
-    CHECK_GL();
+    mProgram.Use();
 
-    GLint fracDoneLocation = glGetUniformLocation(*pProgram, "fracDone");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(fracDoneLocation);
+    GLint fracDoneLocation = mProgram.GetUniformLocation("fracDone");
 
     size_t countRemainingJobs = mQueue.Size();
     glUniform1f(fracDoneLocation, float(countStartJobs - countRemainingJobs) / countStartJobs);
     CHECK_GL();
 
-    glBindBuffer(GL_ARRAY_BUFFER, *pBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pBuffer);
 
     glEnableVertexAttribArray(LOAD_POSITON_INDEX);
     CHECK_GL();
@@ -251,7 +279,8 @@ void LoadScene::Render(void)
 }
 void LoadScene::Update(void)
 {
-    if (mQueue.Size() <= 0)
+    // The GL jobs that the loading pushed must be done too, before the loaded scene can render.
+    if (mQueue.Size() <= 0 && App::Instance().CountPendingGL() <= 0)
     {
         mConcurrentManager.JoinAll();
         mErrorManager.ThrowAnyError();
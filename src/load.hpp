@@ -2,36 +2,21 @@
 #define LOAD_HPP
 
 #include <queue>
+#include <deque>
 #include <exception>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <cfloat>
 
 #include <boost/filesystem.hpp>
 
 #include "scene.hpp"
 #include "alloc.hpp"
 #include "concurrency.hpp"
+#include "queue.hpp"
 
 
-class Job
-{
-    public:
-        // This must be thread-safe.
-        virtual void Run(void) = 0;
-};
-
-class Queue
-{
-    private:
-        std::recursive_mutex mtxJobs;
-        std::list<std::shared_ptr<Job>> mJobs;
-    public:
-        std::shared_ptr<Job> Take(void);
-        void Add(std::shared_ptr<Job>);
-        void Add(Job *);  // Gets deleted automatically.
-        size_t Size(void);
-};
-
 class ErrorManager
 {
     private:
@@ -42,6 +27,39 @@ class ErrorManager
         void ThrowAnyError(void);
 };
 
+/**
+ *  Takes all jobs from a queue and runs them in order of priority, until a frame's
+ *  time or upload budget runs out. The rest is kept for the next call.
+ *  For one thread only.
+ */
+class BudgetedJobRunner
+{
+    private:
+        struct PendingJob
+        {
+            float priority;
+            std::unique_ptr<Job> pJob;
+        };
+        std::deque<PendingJob> mPending;
+
+        // Pushed by the runner's own thread, taken in at the next call.
+        std::deque<std::unique_ptr<Job>> mAdded;
+    public:
+        // Runs at least one job. Returns the number of jobs that were deferred.
+        size_t WorkFrom(Queue &, const double maxMillis, const size_t maxBytes);
+
+        /**
+         *  For the runner's own thread, jobs that push jobs use this,
+         *  so that they run at the next call rather than in the same one.
+         */
+        void Add(std::unique_ptr<Job>);
+
+        // Deletes the jobs without running them.
+        void Clear(void);
+
+        size_t CountPending(void) const;
+};
+
 void WorkThreadFunc(Queue &, ErrorManager &);  // Deletes the jobs after running. Stops if no more jobs.
 void WorkAllFrom(Queue &);
 void ClearAllFrom(Queue &);
@@ -59,8 +77,8 @@ class InitializableScene: public Initializable, public Scene
 class LoadScene: public Scene
 {
     private:
-        GLRef pProgram,
-              pBuffer;
+        ShaderProgram mProgram;
+        GLRef pBuffer;
 
         InitializableScene *pLoaded;
 
@@ -0,0 +1,22 @@
+#include <iostream>
+
+#include "app.hpp"
+
+
+int main(int argc, char **argv)
+{
+    App::Instance().exePath = argv[0];
+
+    try
+    {
+        App::Instance().Run();
+
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+
+        return 1;
+    }
+};
@@ -6,6 +6,12 @@
 #include "noise.hpp"
 
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NOISE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
 float PerlinFade(float t)
 {
     return t * t * t * (t * (t * 6 - 15) + 10);
@@ -14,28 +20,27 @@ float Lerp(float t, float a0, float a1)
 {
     return a0 + t * (a1 - a0);
 }
-float PerlinGradient2D(WorldSeed _hash, const vec2 &dir)
-{
-    static vec2 grad2d[] = {{1.0f, 0.0f},
-                            {0.9239f, 0.3827f},
-                            {0.707107f, 0.707107f},
-                            {0.3827f, 0.9239f},
-                            {0.0f, 1.0f},
-                            {-0.3827f, 0.9239f},
-                            {-0.707107f, 0.707107f},
-                            {-0.9239f, 0.3827f},
-                            {-1.0f, 0.0f},
-                            {-0.9239f, -0.3827f},
-                            {-0.707107f, -0.707107f},
-                            {-0.3827f, -0.9239f},
-                            {0.0f, -1.0f},
-                            {0.3827f, -0.9239f},
-                            {0.707107f, -0.707107f},
-                            {0.9239f, -0.3827f}};
-
+const vec2 grad2d[] = {{1.0f, 0.0f},
+                        {0.9239f, 0.3827f},
+                        {0.707107f, 0.707107f},
+                        {0.3827f, 0.9239f},
+                        {0.0f, 1.0f},
+                        {-0.3827f, 0.9239f},
+                        {-0.707107f, 0.707107f},
+                        {-0.9239f, 0.3827f},
+                        {-1.0f, 0.0f},
+                        {-0.9239f, -0.3827f},
+                        {-0.707107f, -0.707107f},
+                        {-0.3827f, -0.9239f},
+                        {0.0f, -1.0f},
+                        {0.3827f, -0.9239f},
+                        {0.707107f, -0.707107f},
+                        {0.9239f, -0.3827f}};
+float PerlinGradient2D(int32_t _hash, const vec2 &dir)
+{
     return dot(grad2d[_hash & 0x0f], dir);
 }
-float PerlinGradient3D(WorldSeed _hash, const vec3 &dir)
+float PerlinGradient3D(int32_t _hash, const vec3 &dir)
 {
     static vec3 grad3d[] = {{1.0f, 1.0f, 0.0f},
                             {-1.0f, 1.0f, 0.0f},
@@ -56,8 +61,8 @@ float PerlinGradient3D(WorldSeed _hash, const vec3 &dir)
 
     return dot(grad3d[_hash & 0x0f], dir);
 }
-typedef WorldSeed Permutations[512];
-void PerlinReseed(const WorldSeed seed, Permutations permutations)
+template <typename T>
+void ShufflePermutations(const WorldSeed seed, T *permutations)
 {
     for (size_t i = 0; i < 256; i++)
     {
@@ -73,6 +78,33 @@ void PerlinReseed(const WorldSeed seed, Permutations permutations)
         permutations[i + 256] = permutations[i];
     }
 }
+void PerlinReseed(const WorldSeed seed, Permutations permutations)
+{
+    ShufflePermutations(seed, permutations);
+}
+Octaves::Octaves(const size_t count, const float frequency, const float lacunarity,
+                 const float persistence, const float amplitude)
+: countOctaves(std::min(count, size_t(MAX_NOISE_OCTAVES)))
+{
+    size_t i;
+    for (i = 0; i < countOctaves; i++)
+    {
+        mFrequencies[i] = frequency * std::pow(lacunarity, float(i));
+        mAmplitudes[i] = amplitude * std::pow(persistence, float(i));
+    }
+}
+size_t Octaves::CountOctaves(void) const
+{
+    return countOctaves;
+}
+float Octaves::GetFrequency(const size_t i) const
+{
+    return mFrequencies[i];
+}
+float Octaves::GetAmplitude(const size_t i) const
+{
+    return mAmplitudes[i];
+}
 PerlinNoiseGenerator2D::PerlinNoiseGenerator2D(const WorldSeed seed)
 {
     PerlinReseed(seed, mPermutations);
@@ -81,10 +113,15 @@ void PerlinNoiseGenerator2D::Reseed(const WorldSeed seed)
 {
     PerlinReseed(seed, mPermutations);
 }
-float PerlinNoiseGenerator2D::Noise(const vec2 &p) const
+/*  The lattice repeats every mask + 1 units, mask + 1 being a power of two, at most 256.
+    Since the permutations are stored twice, a mask of 0xff gives the same hashes as no wrapping at all.
+ */
+float PerlinNoise2D(const Permutations permutations, const vec2 &p, const int32_t mask)
 {
-    const WorldSeed X = WorldSeed(floor(p.x)) & 0xff,
-                    Y = WorldSeed(floor(p.y)) & 0xff;
+    const int32_t X = int32_t(floor(p.x)) & mask,
+                  Y = int32_t(floor(p.y)) & mask,
+                  X1 = (X + 1) & mask,
+                  Y1 = (Y + 1) & mask;
 
     float dx = p.x - floor(p.x),
           dy = p.y - floor(p.y);
@@ -92,13 +129,328 @@ float PerlinNoiseGenerator2D::Noise(const vec2 &p) const
     const float fx = PerlinFade(dx),
                 fy = PerlinFade(dy);
 
-    float grad00 = PerlinGradient2D(mPermutations[X + mPermutations[Y]], {dx, dy}),
-          grad01 = PerlinGradient2D(mPermutations[X + mPermutations[Y + 1]], {dx, dy - 1.0f}),
-          grad11 = PerlinGradient2D(mPermutations[X + 1 + mPermutations[Y + 1]], {dx - 1.0f, dy - 1.0f}),
-          grad10 = PerlinGradient2D(mPermutations[X + 1 + mPermutations[Y]], {dx - 1.0f, dy});
+    float grad00 = PerlinGradient2D(permutations[X + permutations[Y]], {dx, dy}),
+          grad01 = PerlinGradient2D(permutations[X + permutations[Y1]], {dx, dy - 1.0f}),
+          grad11 = PerlinGradient2D(permutations[X1 + permutations[Y1]], {dx - 1.0f, dy - 1.0f}),
+          grad10 = PerlinGradient2D(permutations[X1 + permutations[Y]], {dx - 1.0f, dy});
 
     return Lerp(fy, Lerp(fx, grad00, grad10), Lerp(fx, grad01, grad11));
 }
+float PerlinNoiseGenerator2D::Noise(const vec2 &p) const
+{
+    return PerlinNoise2D(mPermutations, p, 0xff);
+}
+float PerlinNoiseGenerator2D::TiledNoise(const vec2 &p, const int32_t period) const
+{
+    return PerlinNoise2D(mPermutations, p, period - 1);
+}
+/*  Octave by octave, in the same order as the kernels below.
+    Multiplying by the frequency, rather than dividing, saves a division per octave.
+ */
+float PerlinOctaveNoise2D(const Permutations permutations, const vec2 &p, const Octaves &octaves)
+{
+    float total = 0.0f;
+
+    size_t i;
+    for (i = 0; i < octaves.CountOctaves(); i++)
+        total += octaves.GetAmplitude(i) * PerlinNoise2D(permutations, p * octaves.GetFrequency(i), 0xff);
+
+    return total;
+}
+float PerlinNoiseGenerator2D::OctaveNoise(const vec2 &p, const Octaves &octaves) const
+{
+    return PerlinOctaveNoise2D(mPermutations, p, octaves);
+}
+typedef void (*PerlinNoise2DKernel)(const Permutations, const float *, const float *, float *, const size_t, const int32_t);
+typedef void (*PerlinOctaveNoise2DKernel)(const Permutations, const float *, const float *, float *, const size_t,
+                                          const Octaves &);
+void PerlinNoise2DScalar(const Permutations permutations,
+                         const float *xs, const float *ys, float *out, const size_t count, const int32_t mask)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+        out[i] = PerlinNoise2D(permutations, {xs[i], ys[i]}, mask);
+}
+void PerlinOctaveNoise2DScalar(const Permutations permutations,
+                               const float *xs, const float *ys, float *out, const size_t count,
+                               const Octaves &octaves)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+        out[i] = PerlinOctaveNoise2D(permutations, {xs[i], ys[i]}, octaves);
+}
+#ifdef NOISE_X86_KERNELS
+/*  The kernels below perform exactly the same float operations as PerlinNoise2D,
+    in the same order, so that chunk edges match no matter which kernel was used.
+ */
+__attribute__((target("avx2")))
+__m256 PerlinFadeAVX2(const __m256 t)
+{
+    const __m256 c6 = _mm256_set1_ps(6.0f),
+                 c15 = _mm256_set1_ps(15.0f),
+                 c10 = _mm256_set1_ps(10.0f);
+
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t),
+                         _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, c6), c15)), c10));
+}
+__attribute__((target("avx2")))
+__m256 LerpAVX2(const __m256 t, const __m256 a0, const __m256 a1)
+{
+    return _mm256_add_ps(a0, _mm256_mul_ps(t, _mm256_sub_ps(a1, a0)));
+}
+__attribute__((target("avx2")))
+__m256 PerlinGradient2DAVX2(const __m256i _hash, const __m256 dx, const __m256 dy)
+{
+    const __m256i i = _mm256_slli_epi32(_mm256_and_si256(_hash, _mm256_set1_epi32(0x0f)), 1);
+    const float *pGrad = (const float *)grad2d;
+
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(pGrad, i, 4), dx),
+                         _mm256_mul_ps(_mm256_i32gather_ps(pGrad + 1, i, 4), dy));
+}
+// Eight points at once.
+__attribute__((target("avx2"), always_inline)) inline
+__m256 PerlinNoise2DAVX2(const Permutations permutations, const __m256 x, const __m256 y, const __m256i mask)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 onef = _mm256_set1_ps(1.0f);
+
+    const __m256 floorX = _mm256_floor_ps(x),
+                 floorY = _mm256_floor_ps(y);
+
+    const __m256i X = _mm256_and_si256(_mm256_cvttps_epi32(floorX), mask),
+                  Y = _mm256_and_si256(_mm256_cvttps_epi32(floorY), mask),
+                  X1 = _mm256_and_si256(_mm256_add_epi32(X, one), mask),
+                  Y1 = _mm256_and_si256(_mm256_add_epi32(Y, one), mask);
+
+    const __m256 dx = _mm256_sub_ps(x, floorX),
+                 dy = _mm256_sub_ps(y, floorY),
+                 dx1 = _mm256_sub_ps(dx, onef),
+                 dy1 = _mm256_sub_ps(dy, onef);
+
+    const __m256 fx = PerlinFadeAVX2(dx),
+                 fy = PerlinFadeAVX2(dy);
+
+    const __m256i pY = _mm256_i32gather_epi32(permutations, Y, 4),
+                  pY1 = _mm256_i32gather_epi32(permutations, Y1, 4);
+
+    __m256 grad00 = PerlinGradient2DAVX2(_mm256_i32gather_epi32(permutations, _mm256_add_epi32(X, pY), 4), dx, dy),
+           grad01 = PerlinGradient2DAVX2(_mm256_i32gather_epi32(permutations, _mm256_add_epi32(X, pY1), 4), dx, dy1),
+           grad11 = PerlinGradient2DAVX2(_mm256_i32gather_epi32(permutations, _mm256_add_epi32(X1, pY1), 4), dx1, dy1),
+           grad10 = PerlinGradient2DAVX2(_mm256_i32gather_epi32(permutations, _mm256_add_epi32(X1, pY), 4), dx1, dy);
+
+    return LerpAVX2(fy, LerpAVX2(fx, grad00, grad10), LerpAVX2(fx, grad01, grad11));
+}
+__attribute__((target("avx2")))
+void PerlinNoise2DAVX2(const Permutations permutations,
+                       const float *xs, const float *ys, float *out, const size_t count, const int32_t latticeMask)
+{
+    const __m256i mask = _mm256_set1_epi32(latticeMask);
+
+    size_t i;
+    for (i = 0; (i + 8) <= count; i += 8)
+        _mm256_storeu_ps(out + i, PerlinNoise2DAVX2(permutations, _mm256_loadu_ps(xs + i), _mm256_loadu_ps(ys + i), mask));
+
+    PerlinNoise2DScalar(permutations, xs + i, ys + i, out + i, count - i, latticeMask);
+}
+// All octaves of eight points are summed in registers, before moving on to the next eight.
+__attribute__((target("avx2")))
+void PerlinOctaveNoise2DAVX2(const Permutations permutations,
+                             const float *xs, const float *ys, float *out, const size_t count,
+                             const Octaves &octaves)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const size_t countOctaves = octaves.CountOctaves();
+
+    __m256 frequencies[MAX_NOISE_OCTAVES], amplitudes[MAX_NOISE_OCTAVES],
+           x, y, total;
+
+    size_t i, j;
+    for (j = 0; j < countOctaves; j++)
+    {
+        frequencies[j] = _mm256_set1_ps(octaves.GetFrequency(j));
+        amplitudes[j] = _mm256_set1_ps(octaves.GetAmplitude(j));
+    }
+
+    for (i = 0; (i + 8) <= count; i += 8)
+    {
+        x = _mm256_loadu_ps(xs + i);
+        y = _mm256_loadu_ps(ys + i);
+        total = _mm256_setzero_ps();
+
+        for (j = 0; j < countOctaves; j++)
+            total = _mm256_add_ps(total, _mm256_mul_ps(amplitudes[j],
+                                                       PerlinNoise2DAVX2(permutations,
+                                                                         _mm256_mul_ps(x, frequencies[j]),
+                                                                         _mm256_mul_ps(y, frequencies[j]), mask)));
+
+        _mm256_storeu_ps(out + i, total);
+    }
+
+    PerlinOctaveNoise2DScalar(permutations, xs + i, ys + i, out + i, count - i, octaves);
+}
+__attribute__((target("sse4.1")))
+__m128 PerlinFadeSSE41(const __m128 t)
+{
+    const __m128 c6 = _mm_set1_ps(6.0f),
+                 c15 = _mm_set1_ps(15.0f),
+                 c10 = _mm_set1_ps(10.0f);
+
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t),
+                      _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, c6), c15)), c10));
+}
+__attribute__((target("sse4.1")))
+__m128 LerpSSE41(const __m128 t, const __m128 a0, const __m128 a1)
+{
+    return _mm_add_ps(a0, _mm_mul_ps(t, _mm_sub_ps(a1, a0)));
+}
+__attribute__((target("sse4.1")))
+__m128 PerlinGradient2DSSE41(const int32_t *hashes, const __m128 dx, const __m128 dy)
+{
+    // SSE has no gather instructions, so look the gradients up one by one.
+    alignas(16) float gx[4], gy[4];
+
+    size_t i;
+    for (i = 0; i < 4; i++)
+    {
+        gx[i] = grad2d[hashes[i] & 0x0f].x;
+        gy[i] = grad2d[hashes[i] & 0x0f].y;
+    }
+
+    return _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx), dx),
+                      _mm_mul_ps(_mm_load_ps(gy), dy));
+}
+// Four points at once.
+__attribute__((target("sse4.1"), always_inline)) inline
+__m128 PerlinNoise2DSSE41(const Permutations permutations, const __m128 x, const __m128 y, const int32_t latticeMask)
+{
+    const __m128i mask = _mm_set1_epi32(latticeMask);
+    const __m128 onef = _mm_set1_ps(1.0f);
+
+    alignas(16) int32_t X[4], Y[4], h00[4], h01[4], h11[4], h10[4];
+    int32_t X1, Y1;
+
+    const __m128 floorX = _mm_floor_ps(x),
+                 floorY = _mm_floor_ps(y);
+
+    _mm_store_si128((__m128i *)X, _mm_and_si128(_mm_cvttps_epi32(floorX), mask));
+    _mm_store_si128((__m128i *)Y, _mm_and_si128(_mm_cvttps_epi32(floorY), mask));
+
+    size_t j;
+    for (j = 0; j < 4; j++)
+    {
+        X1 = (X[j] + 1) & latticeMask;
+        Y1 = (Y[j] + 1) & latticeMask;
+
+        h00[j] = permutations[X[j] + permutations[Y[j]]];
+        h01[j] = permutations[X[j] + permutations[Y1]];
+        h11[j] = permutations[X1 + permutations[Y1]];
+        h10[j] = permutations[X1 + permutations[Y[j]]];
+    }
+
+    const __m128 dx = _mm_sub_ps(x, floorX),
+                 dy = _mm_sub_ps(y, floorY),
+                 dx1 = _mm_sub_ps(dx, onef),
+                 dy1 = _mm_sub_ps(dy, onef);
+
+    const __m128 fx = PerlinFadeSSE41(dx),
+                 fy = PerlinFadeSSE41(dy);
+
+    __m128 grad00 = PerlinGradient2DSSE41(h00, dx, dy),
+           grad01 = PerlinGradient2DSSE41(h01, dx, dy1),
+           grad11 = PerlinGradient2DSSE41(h11, dx1, dy1),
+           grad10 = PerlinGradient2DSSE41(h10, dx1, dy);
+
+    return LerpSSE41(fy, LerpSSE41(fx, grad00, grad10), LerpSSE41(fx, grad01, grad11));
+}
+__attribute__((target("sse4.1")))
+void PerlinNoise2DSSE41(const Permutations permutations,
+                        const float *xs, const float *ys, float *out, const size_t count, const int32_t latticeMask)
+{
+    size_t i;
+    for (i = 0; (i + 4) <= count; i += 4)
+        _mm_storeu_ps(out + i, PerlinNoise2DSSE41(permutations, _mm_loadu_ps(xs + i), _mm_loadu_ps(ys + i), latticeMask));
+
+    PerlinNoise2DScalar(permutations, xs + i, ys + i, out + i, count - i, latticeMask);
+}
+__attribute__((target("sse4.1")))
+void PerlinOctaveNoise2DSSE41(const Permutations permutations,
+                              const float *xs, const float *ys, float *out, const size_t count,
+                              const Octaves &octaves)
+{
+    const size_t countOctaves = octaves.CountOctaves();
+
+    __m128 frequencies[MAX_NOISE_OCTAVES], amplitudes[MAX_NOISE_OCTAVES],
+           x, y, total;
+
+    size_t i, j;
+    for (j = 0; j < countOctaves; j++)
+    {
+        frequencies[j] = _mm_set1_ps(octaves.GetFrequency(j));
+        amplitudes[j] = _mm_set1_ps(octaves.GetAmplitude(j));
+    }
+
+    for (i = 0; (i + 4) <= count; i += 4)
+    {
+        x = _mm_loadu_ps(xs + i);
+        y = _mm_loadu_ps(ys + i);
+        total = _mm_setzero_ps();
+
+        for (j = 0; j < countOctaves; j++)
+            total = _mm_add_ps(total, _mm_mul_ps(amplitudes[j],
+                                                 PerlinNoise2DSSE41(permutations,
+                                                                    _mm_mul_ps(x, frequencies[j]),
+                                                                    _mm_mul_ps(y, frequencies[j]), 0xff)));
+
+        _mm_storeu_ps(out + i, total);
+    }
+
+    PerlinOctaveNoise2DScalar(permutations, xs + i, ys + i, out + i, count - i, octaves);
+}
+#endif  // NOISE_X86_KERNELS
+PerlinNoise2DKernel ChoosePerlinNoise2DKernel(void)
+{
+#ifdef NOISE_X86_KERNELS
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return PerlinNoise2DAVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        return PerlinNoise2DSSE41;
+#endif
+    return PerlinNoise2DScalar;
+}
+PerlinOctaveNoise2DKernel ChoosePerlinOctaveNoise2DKernel(void)
+{
+#ifdef NOISE_X86_KERNELS
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return PerlinOctaveNoise2DAVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        return PerlinOctaveNoise2DSSE41;
+#endif
+    return PerlinOctaveNoise2DScalar;
+}
+void PerlinNoiseGenerator2D::BatchNoise(const float *xs, const float *ys, float *out, const size_t count) const
+{
+    static const PerlinNoise2DKernel kernel = ChoosePerlinNoise2DKernel();
+
+    kernel(mPermutations, xs, ys, out, count, 0xff);
+}
+void PerlinNoiseGenerator2D::BatchTiledNoise(const float *xs, const float *ys, float *out, const size_t count,
+                                             const int32_t period) const
+{
+    static const PerlinNoise2DKernel kernel = ChoosePerlinNoise2DKernel();
+
+    kernel(mPermutations, xs, ys, out, count, period - 1);
+}
+void PerlinNoiseGenerator2D::BatchOctaveNoise(const float *xs, const float *ys, float *out, const size_t count,
+                                              const Octaves &octaves) const
+{
+    static const PerlinOctaveNoise2DKernel kernel = ChoosePerlinOctaveNoise2DKernel();
+
+    kernel(mPermutations, xs, ys, out, count, octaves);
+}
 PerlinNoiseGenerator3D::PerlinNoiseGenerator3D(const WorldSeed seed)
 {
     PerlinReseed(seed, mPermutations);
@@ -109,9 +461,9 @@ void PerlinNoiseGenerator3D::Reseed(const WorldSeed seed)
 }
 float PerlinNoiseGenerator3D::Noise(const vec3 &p) const
 {
-    const WorldSeed X = WorldSeed(floor(p.x)) & 0xff;
-    const WorldSeed Y = WorldSeed(floor(p.y)) & 0xff;
-    const WorldSeed Z = WorldSeed(floor(p.z)) & 0xff;
+    const int32_t X = int32_t(floor(p.x)) & 0xff;
+    const int32_t Y = int32_t(floor(p.y)) & 0xff;
+    const int32_t Z = int32_t(floor(p.z)) & 0xff;
 
     float dx = p.x - floor(p.x),
           dy = p.y - floor(p.y),
@@ -133,25 +485,133 @@ float PerlinNoiseGenerator3D::Noise(const vec3 &p) const
     return Lerp(fz, Lerp(fy, Lerp(fx, grad000, grad100), Lerp(fx, grad010, grad110)),
                     Lerp(fy, Lerp(fx, grad001, grad101), Lerp(fx, grad011, grad111)));
 }
-template <class NoiseGenerator, typename Vec>
-float OctaveNoise(const NoiseGenerator &child, const Vec &v, const float persistence, const size_t countOctaves)
+float PerlinNoiseGenerator3D::OctaveNoise(const vec3 &p, const Octaves &octaves) const
 {
-    float total = 0.0f,
-          frequency = 1.0f,
-          amplitude = 1.0f,
-          maxValue = 0.0f;  // Used for normalizing result
+    float total = 0.0f;
+
     size_t i;
+    for (i = 0; i < octaves.CountOctaves(); i++)
+        total += octaves.GetAmplitude(i) * PerlinNoiseGenerator3D::Noise(p * octaves.GetFrequency(i));
 
-    for(i = 0; i < countOctaves; i++)
-    {
-        total += child.Noise(v * frequency) * amplitude;
+    return total;
+}
+SimplexNoiseGenerator2D::SimplexNoiseGenerator2D(const WorldSeed seed)
+{
+    ShufflePermutations(seed, mPermutations);
+}
+void SimplexNoiseGenerator2D::Reseed(const WorldSeed seed)
+{
+    ShufflePermutations(seed, mPermutations);
+}
+// Skews the square lattice into triangles and back.
+#define SIMPLEX_SKEW2D 0.36602540378f    // (sqrt(3) - 1) / 2
+#define SIMPLEX_UNSKEW2D 0.2113248654f   // (3 - sqrt(3)) / 6
 
-        maxValue += amplitude;
+// Scales the sum of the corners to about -1.0f .. 1.0f.
+#define SIMPLEX_SCALE2D 99.2f
+#define SIMPLEX_SCALE3D 32.0f
 
-        amplitude *= persistence;
-        frequency *= 2;
-    }
+// The falloff is clamped, rather than branched on, since the branch would be unpredictable.
+float SimplexCorner2D(const int32_t _hash, const float dx, const float dy)
+{
+    float t = std::max(0.5f - dx * dx - dy * dy, 0.0f);
+
+    t *= t;
+    return t * t * PerlinGradient2D(_hash, {dx, dy});
+}
+float SimplexNoise2D(const SimplexPermutations permutations, const vec2 &p)
+{
+    const float s = (p.x + p.y) * SIMPLEX_SKEW2D,
+                fi = floor(p.x + s),
+                fj = floor(p.y + s),
+                t = (fi + fj) * SIMPLEX_UNSKEW2D;
+
+    // Relative to the first corner.
+    const float dx0 = p.x - (fi - t),
+                dy0 = p.y - (fj - t);
+
+    // Which of the square's two triangles.
+    const int32_t i1 = dx0 > dy0,
+                  j1 = 1 - i1;
+
+    const float dx1 = dx0 - i1 + SIMPLEX_UNSKEW2D,
+                dy1 = dy0 - j1 + SIMPLEX_UNSKEW2D,
+                dx2 = dx0 - 1.0f + 2 * SIMPLEX_UNSKEW2D,
+                dy2 = dy0 - 1.0f + 2 * SIMPLEX_UNSKEW2D;
 
-    return total / maxValue;
+    const int32_t I = int32_t(fi) & 0xff,
+                  J = int32_t(fj) & 0xff;
+
+    return SIMPLEX_SCALE2D * (SimplexCorner2D(permutations[I + permutations[J]], dx0, dy0) +
+                              SimplexCorner2D(permutations[I + i1 + permutations[J + j1]], dx1, dy1) +
+                              SimplexCorner2D(permutations[I + 1 + permutations[J + 1]], dx2, dy2));
+}
+float SimplexNoiseGenerator2D::Noise(const vec2 &p) const
+{
+    return SimplexNoise2D(mPermutations, p);
+}
+void SimplexNoiseGenerator2D::BatchNoise(const float *xs, const float *ys, float *out, const size_t count) const
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+        out[i] = SimplexNoise2D(mPermutations, {xs[i], ys[i]});
+}
+SimplexNoiseGenerator3D::SimplexNoiseGenerator3D(const WorldSeed seed)
+{
+    ShufflePermutations(seed, mPermutations);
+}
+void SimplexNoiseGenerator3D::Reseed(const WorldSeed seed)
+{
+    ShufflePermutations(seed, mPermutations);
 }
+#define SIMPLEX_SKEW3D (1.0f / 3)
+#define SIMPLEX_UNSKEW3D (1.0f / 6)
 
+float SimplexCorner3D(const int32_t _hash, const float dx, const float dy, const float dz)
+{
+    float t = std::max(0.6f - dx * dx - dy * dy - dz * dz, 0.0f);
+
+    t *= t;
+    return t * t * PerlinGradient3D(_hash, {dx, dy, dz});
+}
+float SimplexNoiseGenerator3D::Noise(const vec3 &p) const
+{
+    const float s = (p.x + p.y + p.z) * SIMPLEX_SKEW3D,
+                fi = floor(p.x + s),
+                fj = floor(p.y + s),
+                fk = floor(p.z + s),
+                t = (fi + fj + fk) * SIMPLEX_UNSKEW3D;
+
+    const float dx0 = p.x - (fi - t),
+                dy0 = p.y - (fj - t),
+                dz0 = p.z - (fk - t);
+
+    /*  The cube holds six tetrahedra, the order of the coords tells which one.
+        Ranking them avoids branching.
+     */
+    const int32_t rx = (dx0 >= dy0) + (dx0 >= dz0),
+                  ry = (dy0 > dx0) + (dy0 >= dz0),
+                  rz = (dz0 > dx0) + (dz0 > dy0),
+                  i1 = rx >= 2, j1 = ry >= 2, k1 = rz >= 2,
+                  i2 = rx >= 1, j2 = ry >= 1, k2 = rz >= 1;
+
+    const float dx1 = dx0 - i1 + SIMPLEX_UNSKEW3D,
+                dy1 = dy0 - j1 + SIMPLEX_UNSKEW3D,
+                dz1 = dz0 - k1 + SIMPLEX_UNSKEW3D,
+                dx2 = dx0 - i2 + 2 * SIMPLEX_UNSKEW3D,
+                dy2 = dy0 - j2 + 2 * SIMPLEX_UNSKEW3D,
+                dz2 = dz0 - k2 + 2 * SIMPLEX_UNSKEW3D,
+                dx3 = dx0 - 1.0f + 3 * SIMPLEX_UNSKEW3D,
+                dy3 = dy0 - 1.0f + 3 * SIMPLEX_UNSKEW3D,
+                dz3 = dz0 - 1.0f + 3 * SIMPLEX_UNSKEW3D;
+
+    const int32_t I = int32_t(fi) & 0xff,
+                  J = int32_t(fj) & 0xff,
+                  K = int32_t(fk) & 0xff;
+
+    const uint8_t *P = mPermutations;
+    return SIMPLEX_SCALE3D * (SimplexCorner3D(P[I + P[J + P[K]]], dx0, dy0, dz0) +
+                              SimplexCorner3D(P[I + i1 + P[J + j1 + P[K + k1]]], dx1, dy1, dz1) +
+                              SimplexCorner3D(P[I + i2 + P[J + j2 + P[K + k2]]], dx2, dy2, dz2) +
+                              SimplexCorner3D(P[I + 1 + P[J + 1 + P[K + 1]]], dx3, dy3, dz3));
+}
@@ -7,6 +7,29 @@ using namespace glm;
 
 typedef uint64_t WorldSeed;
 
+#define MAX_NOISE_OCTAVES 16
+
+/**
+ *  Fractal noise: octave i is sampled at frequency * lacunarity^i and
+ *  weighted by amplitude * persistence^i. The sum is not normalized.
+ *  The factors are worked out once, here, rather than per point.
+ */
+class Octaves
+{
+private:
+    size_t countOctaves;
+    float mFrequencies[MAX_NOISE_OCTAVES],
+          mAmplitudes[MAX_NOISE_OCTAVES];
+public:
+    // More than MAX_NOISE_OCTAVES octaves are cut off.
+    Octaves(const size_t count, const float frequency, const float lacunarity,
+            const float persistence, const float amplitude);
+
+    size_t CountOctaves(void) const;
+    float GetFrequency(const size_t) const;
+    float GetAmplitude(const size_t) const;
+};
+
 class NoiseGenerator2D
 {
 public:
@@ -21,7 +44,8 @@ public:
     virtual float Noise(const vec3 &) const = 0;
 };
 
-typedef WorldSeed Permutations[512];
+// Entries are always between 0 and 255, 32-bit so that they can be gathered by SIMD instructions.
+typedef int32_t Permutations[512];
 
 class PerlinNoiseGenerator2D : public NoiseGenerator2D
 {
@@ -33,6 +57,28 @@ public:
     void Reseed(const WorldSeed seed);
 
     float Noise(const vec2 &p) const;
+
+    /**
+     *  Sets out[i] to the noise at (xs[i], ys[i]), for i < count.
+     *  Uses AVX2 or SSE4.1 if the cpu supports it, results are the same as Noise.
+     */
+    void BatchNoise(const float *xs, const float *ys, float *out, const size_t count) const;
+
+    /**
+     *  Like Noise and BatchNoise, but repeating every period units along both axes.
+     *  The period must be a power of two, at most 256.
+     */
+    float TiledNoise(const vec2 &p, const int32_t period) const;
+    void BatchTiledNoise(const float *xs, const float *ys, float *out, const size_t count,
+                         const int32_t period) const;
+
+    /**
+     *  Sums all octaves at the point(s). The batch version does all octaves of a group of points
+     *  before moving on to the next group. Results are the same as OctaveNoise.
+     */
+    float OctaveNoise(const vec2 &p, const Octaves &) const;
+    void BatchOctaveNoise(const float *xs, const float *ys, float *out, const size_t count,
+                          const Octaves &) const;
 };
 
 class PerlinNoiseGenerator3D : public NoiseGenerator3D
@@ -45,6 +91,42 @@ public:
     void Reseed(const WorldSeed seed);
 
     float Noise(const vec3 &p) const;
+
+    float OctaveNoise(const vec3 &p, const Octaves &) const;
+};
+
+// Simplex noise only needs bytes, so that a table takes 512 bytes.
+typedef uint8_t SimplexPermutations[512];
+
+/**
+ *  Samples the corners of a triangle, rather than a square:
+ *  three lattice lookups per point instead of four.
+ */
+class SimplexNoiseGenerator2D : public NoiseGenerator2D
+{
+private:
+    SimplexPermutations mPermutations;
+public:
+    SimplexNoiseGenerator2D(const WorldSeed seed);
+
+    void Reseed(const WorldSeed seed);
+
+    float Noise(const vec2 &p) const;
+
+    void BatchNoise(const float *xs, const float *ys, float *out, const size_t count) const;
+};
+
+// Four lattice lookups per point, instead of eight.
+class SimplexNoiseGenerator3D : public NoiseGenerator3D
+{
+private:
+    SimplexPermutations mPermutations;
+public:
+    SimplexNoiseGenerator3D(const WorldSeed seed);
+
+    void Reseed(const WorldSeed seed);
+
+    float Noise(const vec3 &p) const;
 };
 
 #endif  // NOISE_HPP
@@ -0,0 +1,156 @@
+/**
+ *  Compares the Perlin and simplex generators:
+ *
+ *      noisebench [grid size]
+ *
+ *  Per sample, on random points, and per chunk: a grid of heights made
+ *  the way GroundGenerator::GetVerticalCoords makes them.
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <boost/format.hpp>
+
+#include "noise.hpp"
+
+
+#define COUNT_BENCH_SAMPLES (1 << 20)
+#define COUNT_BENCH_CHUNKS 200
+#define BENCH_SEED 483417628069
+
+// The terrain's octaves, as in GroundGenerator.
+const Octaves groundOctaves(2, 1.0f / 250, 5.0f, 1.0f, 10.0f);
+
+template <typename Function>
+double TimeMillis(Function f)
+{
+    std::chrono::time_point<std::chrono::steady_clock> startTime = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// The result is printed, so that the compiler can't leave the work out.
+template <class Generator, class Vec>
+double TimeSamples(const Generator &generator, const std::vector<Vec> &points, float &sum)
+{
+    return TimeMillis([&]()
+    {
+        for (const Vec &p : points)
+            sum += generator.Noise(p);
+    }) * 1e6 / points.size();
+}
+
+/**
+ *  One batch per row and octave. Simplex has no octave kernel,
+ *  so both generators are also timed with this, for a fair comparison.
+ */
+template <class Generator>
+void FillChunkByOctave(const Generator &generator, const vec2 &origin, const size_t n,
+                       float *xs, float *zs, float *noise, float *heights)
+{
+    size_t ix, iz, octave;
+
+    for (ix = 0; ix < n; ix++)
+    {
+        float *row = heights + ix * n;
+        std::fill(row, row + n, 0.0f);
+
+        for (octave = 0; octave < groundOctaves.CountOctaves(); octave++)
+        {
+            for (iz = 0; iz < n; iz++)
+            {
+                xs[iz] = (origin.x + float(ix)) * groundOctaves.GetFrequency(octave);
+                zs[iz] = (origin.y + float(iz)) * groundOctaves.GetFrequency(octave);
+            }
+            generator.BatchNoise(xs, zs, noise, n);
+
+            for (iz = 0; iz < n; iz++)
+                row[iz] += groundOctaves.GetAmplitude(octave) * noise[iz];
+        }
+    }
+}
+// What the game does.
+void FillChunkFused(const PerlinNoiseGenerator2D &generator, const vec2 &origin, const size_t n,
+                    float *xs, float *zs, float *heights)
+{
+    size_t ix, iz;
+
+    for (iz = 0; iz < n; iz++)
+        zs[iz] = origin.y + float(iz);
+
+    for (ix = 0; ix < n; ix++)
+    {
+        std::fill(xs, xs + n, origin.x + float(ix));
+        generator.BatchOctaveNoise(xs, zs, heights + ix * n, n, groundOctaves);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const size_t n = argc > 1 ? std::stoul(argv[1]) : 129;
+
+    PerlinNoiseGenerator2D perlin2D(BENCH_SEED);
+    PerlinNoiseGenerator3D perlin3D(BENCH_SEED);
+    SimplexNoiseGenerator2D simplex2D(BENCH_SEED);
+    SimplexNoiseGenerator3D simplex3D(BENCH_SEED);
+
+    std::default_random_engine engine(1);
+    std::uniform_real_distribution<float> distribution(-1000.0f, 1000.0f);
+
+    std::vector<vec2> points2D(COUNT_BENCH_SAMPLES);
+    std::vector<vec3> points3D(COUNT_BENCH_SAMPLES);
+    for (vec2 &p : points2D)
+        p = vec2(distribution(engine), distribution(engine));
+    for (vec3 &p : points3D)
+        p = vec3(distribution(engine), distribution(engine), distribution(engine));
+
+    float sum = 0.0f;
+
+    std::cout << "per sample, in ns" << std::endl;
+    std::cout << boost::format("  2D  perlin %6.1f  simplex %6.1f")
+                 % TimeSamples(perlin2D, points2D, sum) % TimeSamples(simplex2D, points2D, sum) << std::endl;
+    std::cout << boost::format("  3D  perlin %6.1f  simplex %6.1f")
+                 % TimeSamples(perlin3D, points3D, sum) % TimeSamples(simplex3D, points3D, sum) << std::endl;
+
+    std::unique_ptr<float[]> xs(new float[n]),
+                             zs(new float[n]),
+                             noise(new float[n]),
+                             heights(new float[n * n]);
+    std::vector<vec2> origins(COUNT_BENCH_CHUNKS);
+    for (vec2 &origin : origins)
+        origin = vec2(distribution(engine), distribution(engine));
+
+    double perlinMillis = TimeMillis([&]()
+    {
+        for (const vec2 &origin : origins)
+            FillChunkByOctave(perlin2D, origin, n, xs.get(), zs.get(), noise.get(), heights.get());
+    }) / COUNT_BENCH_CHUNKS;
+    sum += heights[0];
+
+    double simplexMillis = TimeMillis([&]()
+    {
+        for (const vec2 &origin : origins)
+            FillChunkByOctave(simplex2D, origin, n, xs.get(), zs.get(), noise.get(), heights.get());
+    }) / COUNT_BENCH_CHUNKS;
+    sum += heights[0];
+
+    double fusedMillis = TimeMillis([&]()
+    {
+        for (const vec2 &origin : origins)
+            FillChunkFused(perlin2D, origin, n, xs.get(), zs.get(), heights.get());
+    }) / COUNT_BENCH_CHUNKS;
+    sum += heights[0];
+
+    std::cout << boost::format("per %ux%u chunk, %u octaves, in ms") % n % n % groundOctaves.CountOctaves() << std::endl;
+    std::cout << boost::format("  batch per octave  perlin %6.3f  simplex %6.3f") % perlinMillis % simplexMillis << std::endl;
+    std::cout << boost::format("  fused octaves     perlin %6.3f") % fusedMillis << std::endl;
+
+    std::cout << "checksum " << sum << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,621 @@
+#include <algorithm>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "occlusion.hpp"
+#include "app.hpp"
+#include "error.hpp"
+#include "shader.hpp"
+
+
+#define OCCLUSION_BOXMIN_INDEX 0
+#define OCCLUSION_BOXMAX_INDEX 1
+
+// Width of the visibility texture, the boxes go row by row.
+#define OCCLUSION_ROW_LENGTH 256
+
+// One triangle that covers the screen.
+const char hiZVertexShaderSrc[] = R"shader(
+#version 150
+
+void main()
+{
+    gl_Position = vec4(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID >> 1) * 4 - 1), 0.0, 1.0);
+}
+)shader";
+
+const char hiZCopyFragmentShaderSrc[] = R"shader(
+#version 150
+
+uniform sampler2D source;
+
+out float depth;
+
+void main()
+{
+    depth = texelFetch(source, ivec2(gl_FragCoord.xy), 0).r;
+}
+)shader";
+
+/**
+ *  A multisampled pixel is as far as its farthest sample, so that
+ *  a box is only hidden behind the pixel if it's behind all of its samples.
+ */
+const char hiZResolveFragmentShaderSrc[] = R"shader(
+#version 150
+
+uniform sampler2DMS source;
+uniform int countSamples;
+uniform ivec2 offset;
+
+out float depth;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy) + offset;
+
+    depth = texelFetch(source, p, 0).r;
+    for (int i = 1; i < countSamples; i++)
+        depth = max(depth, texelFetch(source, p, i).r);
+}
+)shader";
+
+/**
+ *  Only the source level is in range, so that's lod 0.
+ *  At odd sizes, the last texel covers one texel less.
+ */
+const char hiZReduceFragmentShaderSrc[] = R"shader(
+#version 150
+
+uniform sampler2D source;
+
+out float depth;
+
+void main()
+{
+    ivec2 last = textureSize(source, 0) - 1,
+          p = ivec2(gl_FragCoord.xy) * 2;
+
+    depth = max(max(texelFetch(source, min(p, last), 0).r,
+                    texelFetch(source, min(p + ivec2(1, 0), last), 0).r),
+                max(texelFetch(source, min(p + ivec2(0, 1), last), 0).r,
+                    texelFetch(source, min(p + ivec2(1, 1), last), 0).r));
+}
+)shader";
+
+/**
+ *  Each box is a point, drawn on its own texel in the visibility texture.
+ *  The level is chosen so that the box covers at most 2x2 texels.
+ */
+const char occlusionTestVertexShaderSrc[] = R"shader(
+#version 150
+
+in vec3 boxMin;
+in vec3 boxMax;
+
+uniform mat4 projectionView;
+uniform sampler2D hiZ;
+uniform ivec2 viewportSize;
+uniform int countLevels;
+uniform ivec2 visibilitySize;
+
+flat out float visible;
+
+void main()
+{
+    vec2 rectMin = vec2(1.0e30),
+         rectMax = vec2(-1.0e30);
+    float nearest = 1.0;
+    bool behind = false;
+
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x,
+                           (i & 2) != 0 ? boxMax.y : boxMin.y,
+                           (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 p = projectionView * vec4(corner, 1.0);
+
+        if (p.w <= 0.0)
+            behind = true;
+        else
+        {
+            vec3 ndc = p.xyz / p.w;
+            rectMin = min(rectMin, ndc.xy);
+            rectMax = max(rectMax, ndc.xy);
+            nearest = min(nearest, ndc.z * 0.5 + 0.5);
+        }
+    }
+
+    visible = 1.0;
+    if (!behind)
+    {
+        ivec2 p0 = clamp(ivec2((rectMin * 0.5 + 0.5) * vec2(viewportSize)), ivec2(0), viewportSize - 1),
+              p1 = clamp(ivec2((rectMax * 0.5 + 0.5) * vec2(viewportSize)), ivec2(0), viewportSize - 1);
+
+        int level = 0;
+        while (level < (countLevels - 1) && any(greaterThan((p1 >> level) - (p0 >> level), ivec2(1))))
+            level++;
+
+        ivec2 q0 = p0 >> level,
+              q1 = p1 >> level;
+
+        float farthest = max(max(texelFetch(hiZ, q0, level).r, texelFetch(hiZ, ivec2(q1.x, q0.y), level).r),
+                             max(texelFetch(hiZ, ivec2(q0.x, q1.y), level).r, texelFetch(hiZ, q1, level).r));
+
+        if (nearest > farthest)
+            visible = 0.0;
+    }
+
+    ivec2 texel = ivec2(gl_VertexID % visibilitySize.x, gl_VertexID / visibilitySize.x);
+    gl_Position = vec4((vec2(texel) + 0.5) / vec2(visibilitySize) * 2.0 - 1.0, 0.0, 1.0);
+}
+)shader";
+
+const char occlusionTestFragmentShaderSrc[] = R"shader(
+#version 150
+
+flat in float visible;
+
+out vec4 fragColor;
+
+void main()
+{
+    fragColor = vec4(visible);
+}
+)shader";
+
+// What a depth buffer can be, with the arguments that glTexImage2D needs to make one like it.
+struct OcclusionDepthFormat
+{
+    GLint depthBits, stencilBits;
+    GLenum componentType,
+           internalFormat, format, type;
+};
+const OcclusionDepthFormat occlusionDepthFormats[] = {
+    {16, 0, GL_UNSIGNED_NORMALIZED, GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT},
+    {24, 0, GL_UNSIGNED_NORMALIZED, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT},
+    {24, 8, GL_UNSIGNED_NORMALIZED, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8},
+    {32, 0, GL_UNSIGNED_NORMALIZED, GL_DEPTH_COMPONENT32, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT},
+    {32, 0, GL_FLOAT, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT},
+    {32, 8, GL_FLOAT, GL_DEPTH32F_STENCIL8, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV}
+};
+/**
+ *  Depth is only blitted between equal formats, so the copy must be like the depth buffer
+ *  of the bound read framebuffer. That's either the default one or a framebuffer object.
+ */
+const OcclusionDepthFormat *GetReadDepthFormat(const GLint frameBuffer)
+{
+    GLenum attachment = frameBuffer == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+    GLint objectType, depthBits, stencilBits, componentType;
+
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &objectType);
+    CHECK_GL();
+    if (objectType == GL_NONE)
+        throw GLError("Occlusion culling needs a depth buffer");
+
+    // The stencil bits of the depth attachment itself, they must match too.
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    CHECK_GL();
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+    CHECK_GL();
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+    CHECK_GL();
+
+    for (const OcclusionDepthFormat &format : occlusionDepthFormats)
+    {
+        if (format.depthBits == depthBits && format.stencilBits == stencilBits && format.componentType == GLenum(componentType))
+            return &format;
+    }
+
+    throw GLError("Cannot copy a depth buffer of %d depth bits, %d stencil bits and type 0x%x",
+                  depthBits, stencilBits, componentType);
+}
+void CheckOcclusionFrameBuffer(void)
+{
+    GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+    CHECK_GL();
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        throw GLError("Occlusion framebuffer incomplete: 0x%x", status);
+}
+OcclusionCuller::OcclusionCuller(void)
+: maxBoxes(0), x(0), y(0), width(0), height(0), countLevels(0),
+  pDepthFormat(NULL), countSamples(0), fence(NULL), countPending(0)
+{
+}
+OcclusionCuller::~OcclusionCuller(void)
+{
+    if (fence != NULL)
+        glDeleteSync(fence);
+}
+void OcclusionCuller::Init(const size_t m)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    maxBoxes = m;
+
+    GLManager *pManager = App::Instance().GetGLManager();
+
+    pDepthTexture = pManager->AllocTexture();
+    pMultisampleDepthTexture = pManager->AllocTexture();
+    pHiZTexture = pManager->AllocTexture();
+    pVisibilityTexture = pManager->AllocTexture();
+    pDepthFrameBuffer = pManager->AllocFrameBuffer();
+    pHiZFrameBuffer = pManager->AllocFrameBuffer();
+    pVisibilityFrameBuffer = pManager->AllocFrameBuffer();
+    pBoxBuffer = pManager->AllocBuffer();
+    pReadBuffer = pManager->AllocBuffer();
+    pVertexArray = pManager->AllocVertexArray();
+    pEmptyVertexArray = pManager->AllocVertexArray();
+    mCopyProgram.Alloc();
+    mResolveProgram.Alloc();
+    mReduceProgram.Alloc();
+    mTestProgram.Alloc();
+
+    GLsizei rows = std::max(size_t(1), (maxBoxes + OCCLUSION_ROW_LENGTH - 1) / OCCLUSION_ROW_LENGTH);
+
+    glBindTexture(GL_TEXTURE_2D, *pVisibilityTexture);
+    CHECK_GL();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, OCCLUSION_ROW_LENGTH, rows, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    CHECK_GL();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, *pVisibilityFrameBuffer);
+    CHECK_GL();
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *pVisibilityTexture, 0);
+    CHECK_GL();
+    CheckOcclusionFrameBuffer();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    CHECK_GL();
+
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, *pReadBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, OCCLUSION_ROW_LENGTH * rows, NULL, GL_STREAM_READ);
+    CHECK_GL();
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    pState->BindVertexArray(*pVertexArray);
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pBoxBuffer);
+    glBufferData(GL_ARRAY_BUFFER, maxBoxes * 2 * sizeof(vec3), NULL, GL_STREAM_DRAW);
+    CHECK_GL();
+
+    glEnableVertexAttribArray(OCCLUSION_BOXMIN_INDEX);
+    CHECK_GL();
+    glVertexAttribPointer(OCCLUSION_BOXMIN_INDEX, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), 0);
+    CHECK_GL();
+
+    glEnableVertexAttribArray(OCCLUSION_BOXMAX_INDEX);
+    CHECK_GL();
+    glVertexAttribPointer(OCCLUSION_BOXMAX_INDEX, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), (GLvoid *)sizeof(vec3));
+    CHECK_GL();
+
+    pState->BindVertexArray(0);
+    pState->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    VertexAttributeMap noAttributes, boxAttributes;
+    boxAttributes["boxMin"] = OCCLUSION_BOXMIN_INDEX;
+    boxAttributes["boxMax"] = OCCLUSION_BOXMAX_INDEX;
+
+    App::Instance().PushGL(new ShaderLoadJob(mCopyProgram, hiZVertexShaderSrc, hiZCopyFragmentShaderSrc, noAttributes));
+    App::Instance().PushGL(new ShaderLoadJob(mResolveProgram, hiZVertexShaderSrc, hiZResolveFragmentShaderSrc, noAttributes));
+    App::Instance().PushGL(new ShaderLoadJob(mReduceProgram, hiZVertexShaderSrc, hiZReduceFragmentShaderSrc, noAttributes));
+    App::Instance().PushGL(new ShaderLoadJob(mTestProgram,
+                                             occlusionTestVertexShaderSrc,
+                                             occlusionTestFragmentShaderSrc, boxAttributes));
+}
+void OcclusionCuller::Resize(const GLint viewport[4], const OcclusionDepthFormat *pFormat, const GLint samples)
+{
+    x = viewport[0];
+    y = viewport[1];
+    width = viewport[2];
+    height = viewport[3];
+    pDepthFormat = pFormat;
+    countSamples = samples;
+
+    countLevels = 1;
+    while ((width >> countLevels) > 0 || (height >> countLevels) > 0)
+        countLevels++;
+
+    /*
+     *  Multisampled depth can only be blitted to the same rectangle, with the same number of samples.
+     *  The resolve pass then takes the max of the samples. Single samples are blitted to the origin.
+     */
+    GLuint depthTexture;
+    if (countSamples > 0)
+    {
+        depthTexture = *pMultisampleDepthTexture;
+
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, depthTexture);
+        CHECK_GL();
+        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, countSamples, pDepthFormat->internalFormat,
+                                x + width, y + height, GL_TRUE);
+        CHECK_GL();
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+        CHECK_GL();
+    }
+    else
+    {
+        depthTexture = *pDepthTexture;
+
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        CHECK_GL();
+        glTexImage2D(GL_TEXTURE_2D, 0, pDepthFormat->internalFormat, width, height, 0,
+                     pDepthFormat->format, pDepthFormat->type, NULL);
+        CHECK_GL();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        CHECK_GL();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        CHECK_GL();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+        CHECK_GL();
+    }
+
+    // Each level half the size of the previous, rounded up.
+    glBindTexture(GL_TEXTURE_2D, *pHiZTexture);
+    CHECK_GL();
+    GLsizei level, lw = width, lh = height;
+    for (level = 0; level < countLevels; level++)
+    {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, lw, lh, 0, GL_RED, GL_FLOAT, NULL);
+        CHECK_GL();
+
+        lw = std::max(1, (lw + 1) / 2);
+        lh = std::max(1, (lh + 1) / 2);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, countLevels - 1);
+    CHECK_GL();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL();
+
+    // Whatever was attached before goes off, depth and stencil alike.
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, *pDepthFrameBuffer);
+    CHECK_GL();
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+    CHECK_GL();
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
+                           pDepthFormat->stencilBits > 0 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                           countSamples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depthTexture, 0);
+    CHECK_GL();
+    glDrawBuffer(GL_NONE);
+    CHECK_GL();
+    CheckOcclusionFrameBuffer();
+}
+void OcclusionCuller::BuildHiZ(void)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    pState->BindVertexArray(*pEmptyVertexArray);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, *pHiZFrameBuffer);
+    CHECK_GL();
+
+    glActiveTexture(GL_TEXTURE0);
+    CHECK_GL();
+
+    // Level 0 is a copy of the depth buffer, or the farthest samples of it.
+    if (countSamples > 0)
+    {
+        mResolveProgram.Use();
+        glUniform1i(mResolveProgram.GetUniformLocation("source"), 0);
+        CHECK_GL();
+        glUniform1i(mResolveProgram.GetUniformLocation("countSamples"), countSamples);
+        CHECK_GL();
+        glUniform2i(mResolveProgram.GetUniformLocation("offset"), x, y);
+        CHECK_GL();
+
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, *pMultisampleDepthTexture);
+        CHECK_GL();
+    }
+    else
+    {
+        mCopyProgram.Use();
+        glUniform1i(mCopyProgram.GetUniformLocation("source"), 0);
+        CHECK_GL();
+
+        glBindTexture(GL_TEXTURE_2D, *pDepthTexture);
+        CHECK_GL();
+    }
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *pHiZTexture, 0);
+    CHECK_GL();
+    CheckOcclusionFrameBuffer();
+
+    glViewport(0, 0, width, height);
+    CHECK_GL();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    CHECK_GL();
+
+    if (countSamples > 0)
+    {
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+        CHECK_GL();
+    }
+
+    // Then each level takes the max of the previous.
+    mReduceProgram.Use();
+    glUniform1i(mReduceProgram.GetUniformLocation("source"), 0);
+    CHECK_GL();
+
+    glBindTexture(GL_TEXTURE_2D, *pHiZTexture);
+    CHECK_GL();
+
+    GLsizei level, lw = width, lh = height;
+    for (level = 1; level < countLevels; level++)
+    {
+        lw = std::max(1, (lw + 1) / 2);
+        lh = std::max(1, (lh + 1) / 2);
+
+        // Reading from the level that is not being written to.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        CHECK_GL();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        CHECK_GL();
+
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *pHiZTexture, level);
+        CHECK_GL();
+
+        glViewport(0, 0, lw, lh);
+        CHECK_GL();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        CHECK_GL();
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, countLevels - 1);
+    CHECK_GL();
+}
+bool OcclusionCuller::Test(const mat4 &projectionView, const BoundingBoxes &boxes)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    if (fence != NULL)
+        return false;
+
+    size_t count = std::min(boxes.Size(), maxBoxes), i;
+    if (count <= 0)
+        return false;
+
+    GLint viewport[4], prevFrameBuffer, samples;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    CHECK_GL();
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFrameBuffer);
+    CHECK_GL();
+    glGetIntegerv(GL_SAMPLES, &samples);  // of the bound draw framebuffer
+    CHECK_GL();
+
+    GLboolean blend = pState->IsEnabled(GL_BLEND),
+              cullFace = pState->IsEnabled(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prevFrameBuffer);
+    CHECK_GL();
+
+    const OcclusionDepthFormat *pFormat = GetReadDepthFormat(prevFrameBuffer);
+    if (viewport[0] != x || viewport[1] != y || viewport[2] != width || viewport[3] != height
+            || pFormat != pDepthFormat || samples != countSamples)
+        Resize(viewport, pFormat, samples);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, *pDepthFrameBuffer);
+    CHECK_GL();
+    if (countSamples > 0)
+        glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    else
+        glBlitFramebuffer(x, y, x + width, y + height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    CHECK_GL();
+
+    pState->Disable(GL_DEPTH_TEST);
+    pState->DepthMask(GL_FALSE);
+    pState->Disable(GL_BLEND);
+    pState->Disable(GL_CULL_FACE);
+
+    BuildHiZ();
+
+    mBoxData.resize(count * 2);
+    for (i = 0; i < count; i++)
+        boxes.Get(i, mBoxData[2 * i], mBoxData[2 * i + 1]);
+
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pBoxBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2 * sizeof(vec3), mBoxData.data());
+    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLsizei rows = (count + OCCLUSION_ROW_LENGTH - 1) / OCCLUSION_ROW_LENGTH;
+
+    mTestProgram.Use();
+    glUniformMatrix4fv(mTestProgram.GetUniformLocation("projectionView"), 1, GL_FALSE, value_ptr(projectionView));
+    CHECK_GL();
+    glUniform1i(mTestProgram.GetUniformLocation("hiZ"), 0);
+    CHECK_GL();
+    glUniform2i(mTestProgram.GetUniformLocation("viewportSize"), width, height);
+    CHECK_GL();
+    glUniform1i(mTestProgram.GetUniformLocation("countLevels"), countLevels);
+    CHECK_GL();
+    glUniform2i(mTestProgram.GetUniformLocation("visibilitySize"), OCCLUSION_ROW_LENGTH, rows);
+    CHECK_GL();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, *pVisibilityFrameBuffer);
+    CHECK_GL();
+    glViewport(0, 0, OCCLUSION_ROW_LENGTH, rows);
+    CHECK_GL();
+
+    pState->BindVertexArray(*pVertexArray);
+    glDrawArrays(GL_POINTS, 0, count);
+    CHECK_GL();
+    pState->BindVertexArray(0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL();
+
+    // Read back into the pixel buffer, without waiting for it.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, *pVisibilityFrameBuffer);
+    CHECK_GL();
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, *pReadBuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    CHECK_GL();
+    glReadPixels(0, 0, OCCLUSION_ROW_LENGTH, rows, GL_RED, GL_UNSIGNED_BYTE, 0);
+    CHECK_GL();
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    CHECK_GL();
+    countPending = count;
+
+    // Back to how it was.
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFrameBuffer);
+    CHECK_GL();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    CHECK_GL();
+    pState->Enable(GL_DEPTH_TEST);
+    pState->DepthMask(GL_TRUE);
+    if (blend)
+    {
+        pState->Enable(GL_BLEND);
+    }
+    if (cullFace)
+    {
+        pState->Enable(GL_CULL_FACE);
+    }
+
+    return true;
+}
+bool OcclusionCuller::Collect(std::vector<uint8_t> &visible)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    if (fence == NULL)
+        return false;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    CHECK_GL();
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+
+    glDeleteSync(fence);
+    CHECK_GL();
+    fence = NULL;
+
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, *pReadBuffer);
+    const uint8_t *pData = (const uint8_t *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, countPending, GL_MAP_READ_BIT);
+    CHECK_GL();
+
+    visible.resize(countPending);
+    size_t i;
+    for (i = 0; i < countPending; i++)
+        visible[i] = pData[i] > 127 ? 1 : 0;
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    CHECK_GL();
+    pState->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+using namespace glm;
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "alloc.hpp"
+#include "cull.hpp"
+
+
+struct OcclusionDepthFormat;
+
+
+/**
+ *  Tests boxes against a hierarchical depth buffer, built from what was drawn so far.
+ *  The results come back asynchronously, usually a frame later.
+ *  Only use in the GL thread.
+ */
+class OcclusionCuller
+{
+    private:
+        GLRef pDepthTexture,      // copy of the drawn depth
+              pMultisampleDepthTexture,
+              pHiZTexture,        // max depth pyramid
+              pVisibilityTexture, // one texel per box
+              pDepthFrameBuffer,
+              pHiZFrameBuffer,
+              pVisibilityFrameBuffer,
+              pBoxBuffer,
+              pReadBuffer,
+              pVertexArray,
+              pEmptyVertexArray;
+
+        ShaderProgram mCopyProgram,
+                      mResolveProgram,
+                      mReduceProgram,
+                      mTestProgram;
+
+        size_t maxBoxes;
+        GLint x, y;
+        GLsizei width, height, countLevels;
+
+        // Of the framebuffer that the depth is copied from.
+        const OcclusionDepthFormat *pDepthFormat;
+        GLint countSamples;
+
+        // The test that is on its way back.
+        GLsync fence;
+        size_t countPending;
+
+        std::vector<vec3> mBoxData;
+
+        void Resize(const GLint viewport[4], const OcclusionDepthFormat *, const GLint countSamples);
+        void BuildHiZ(void);
+    public:
+        OcclusionCuller(void);
+        ~OcclusionCuller(void);
+
+        void Init(const size_t maxBoxes);
+
+        /**
+         *  Call right after drawing the occluders. Returns false, without testing,
+         *  if the previous results haven't been collected yet.
+         */
+        bool Test(const mat4 &projectionView, const BoundingBoxes &);
+
+        /**
+         *  Returns true if the results of the last test came back.
+         *  Then visible[i] is set to 0 for each box i that was hidden, 1 otherwise.
+         */
+        bool Collect(std::vector<uint8_t> &visible);
+};
+
+#endif  // OCCLUSION_HPP
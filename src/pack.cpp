@@ -0,0 +1,143 @@
+/**
+ *  Builds the archive from loose resources:
+ *
+ *      pack <archive> <resource dir> <location>...
+ *
+ *  Entries that don't get much smaller, like pngs, are stored as they are,
+ *  so that the game can use them without copying.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <lz4hc.h>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "archive.hpp"
+#include "error.hpp"
+
+
+struct PackedEntry
+{
+    std::string location;
+    std::vector<char> mData;  // as stored
+    ArchiveEntry entry;
+};
+
+void Compress(PackedEntry &packed, const Resource &resource)
+{
+    packed.entry.size = resource.GetSize();
+    packed.entry.hash = HashBytes(resource.GetData(), resource.GetSize());
+
+    std::vector<char> compressed(LZ4_compressBound(resource.GetSize()));
+    int compressedSize = LZ4_compress_HC(resource.GetData(), compressed.data(),
+                                         resource.GetSize(), compressed.size(), LZ4HC_CLEVEL_MAX);
+
+    // Require a gain of at least an eighth, or decompressing isn't worth it.
+    if (compressedSize > 0 && size_t(compressedSize) < resource.GetSize() - resource.GetSize() / 8)
+    {
+        compressed.resize(compressedSize);
+        packed.mData = std::move(compressed);
+        packed.entry.compression = ARCHIVE_COMPRESSION_LZ4;
+    }
+    else
+    {
+        packed.mData.assign(resource.GetData(), resource.GetData() + resource.GetSize());
+        packed.entry.compression = ARCHIVE_COMPRESSION_NONE;
+    }
+    packed.entry.storedSize = packed.mData.size();
+}
+
+template <typename T>
+void Write(std::vector<char> &v, const T value)
+{
+    const char *p = (const char *)&value;
+    v.insert(v.end(), p, p + sizeof(T));
+}
+
+void WriteArchive(const boost::filesystem::path &path, std::vector<PackedEntry> &entries)
+{
+    size_t indexSize = 0;
+    for (const PackedEntry &packed : entries)
+        indexSize += sizeof(uint16_t) + packed.location.size() + 4 * sizeof(uint64_t) + sizeof(uint32_t);
+
+    // Now that the index size is known, the offsets can be.
+    uint64_t offset = sizeof(ArchiveHeader) + indexSize;
+    std::vector<char> index;
+    for (PackedEntry &packed : entries)
+    {
+        offset = (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+        packed.entry.offset = offset;
+        offset += packed.entry.storedSize;
+
+        Write<uint16_t>(index, packed.location.size());
+        index.insert(index.end(), packed.location.begin(), packed.location.end());
+        Write<uint64_t>(index, packed.entry.offset);
+        Write<uint64_t>(index, packed.entry.storedSize);
+        Write<uint64_t>(index, packed.entry.size);
+        Write<uint64_t>(index, packed.entry.hash);
+        Write<uint32_t>(index, packed.entry.compression);
+    }
+
+    ArchiveHeader header;
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.countEntries = entries.size();
+    header.indexSize = index.size();
+
+    boost::filesystem::ofstream os(path, std::ios::binary);
+    os.write((const char *)&header, sizeof(header));
+    os.write(index.data(), index.size());
+
+    const char padding[ARCHIVE_ALIGNMENT] = {0};
+    for (const PackedEntry &packed : entries)
+    {
+        os.write(padding, packed.entry.offset - os.tellp());
+        os.write(packed.mData.data(), packed.mData.size());
+    }
+
+    if (!os.good())
+        throw IOError("Cannot write %s", path.string().c_str());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <archive> <resource dir> <location>..." << std::endl;
+        return 1;
+    }
+
+    boost::filesystem::path archivePath(argv[1]),
+                            resourcePath(argv[2]);
+
+    try
+    {
+        std::vector<PackedEntry> entries(argc - 3);
+        int i;
+        for (i = 3; i < argc; i++)
+        {
+            PackedEntry &packed = entries[i - 3];
+            packed.location = argv[i];
+
+            MappedFile file(resourcePath / packed.location);
+            Compress(packed, file);
+
+            std::cout << packed.location << ": " << packed.entry.size << " -> " << packed.entry.storedSize << std::endl;
+        }
+
+        WriteArchive(archivePath, entries);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+
+        boost::system::error_code ec;
+        boost::filesystem::remove(archivePath, ec);
+        return 1;
+    }
+
+    return 0;
+}
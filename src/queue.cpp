@@ -0,0 +1,126 @@
+#include <cstdint>
+
+#include "queue.hpp"
+#include "error.hpp"
+
+
+/*  This is Dmitry Vyukov's bounded MPMC queue. Each slot has a sequence number,
+    that tells whether it's ready to be written (sequence == position)
+    or read (sequence == position + 1) at a given position.
+ */
+Queue::Queue(const size_t capacity)
+: mask(capacity - 1), mSlots(new Slot[capacity]), enqueuePos(0), dequeuePos(0), countOverflow(0)
+{
+    if (capacity < 2 || (capacity & mask) != 0)
+        throw RuntimeError("Queue capacity %u is not a power of two", (unsigned int)capacity);
+
+    size_t i;
+    for (i = 0; i < capacity; i++)
+    {
+        mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        mSlots[i].pJob = NULL;
+    }
+}
+Queue::~Queue(void)
+{
+    while (Take() != NULL);
+}
+size_t Queue::Size(void) const
+{
+    size_t dequeued = dequeuePos.load(std::memory_order_relaxed),
+           enqueued = enqueuePos.load(std::memory_order_relaxed);
+
+    return (enqueued > dequeued ? enqueued - dequeued : 0) + countOverflow.load(std::memory_order_relaxed);
+}
+void Queue::Add(Job *pJob)
+{
+    Add(std::unique_ptr<Job>(pJob));
+}
+void Queue::Add(std::unique_ptr<Job> pJob)
+{
+    // Once jobs overflow, the next ones follow them, to keep the order.
+    if (countOverflow.load(std::memory_order_acquire) > 0 || !TryAdd(pJob.get()))
+    {
+        std::scoped_lock lock(mtxOverflow);
+        mOverflow.push_back(pJob.get());
+        countOverflow++;
+    }
+
+    // The queue owns it now.
+    pJob.release();
+}
+bool Queue::TryAdd(Job *pJob)
+{
+    Slot *pSlot;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed),
+           sequence;
+    intptr_t diff;
+
+    while (true)
+    {
+        pSlot = &mSlots[pos & mask];
+        sequence = pSlot->sequence.load(std::memory_order_acquire);
+        diff = intptr_t(sequence) - intptr_t(pos);
+
+        if (diff == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;  // full
+        else
+            pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    pSlot->pJob = pJob;
+    pSlot->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+std::unique_ptr<Job> Queue::Take(void)
+{
+    Job *pJob = TryTake();
+    if (pJob != NULL || countOverflow.load(std::memory_order_acquire) <= 0)
+        return std::unique_ptr<Job>(pJob);
+
+    std::scoped_lock lock(mtxOverflow);
+    if (mOverflow.empty())
+        return NULL;
+
+    pJob = mOverflow.front();
+    mOverflow.pop_front();
+    countOverflow--;
+
+    return std::unique_ptr<Job>(pJob);
+}
+Job *Queue::TryTake(void)
+{
+    Slot *pSlot;
+    Job *pJob;
+    size_t pos = dequeuePos.load(std::memory_order_relaxed),
+           sequence;
+    intptr_t diff;
+
+    while (true)
+    {
+        pSlot = &mSlots[pos & mask];
+        sequence = pSlot->sequence.load(std::memory_order_acquire);
+        diff = intptr_t(sequence) - intptr_t(pos + 1);
+
+        if (diff == 0)
+        {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return NULL;  // empty
+        else
+            pos = dequeuePos.load(std::memory_order_relaxed);
+    }
+
+    pJob = pSlot->pJob;
+    pSlot->sequence.store(pos + mask + 1, std::memory_order_release);
+
+    return pJob;
+}
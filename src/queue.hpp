@@ -0,0 +1,73 @@
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <cfloat>
+#include <cstddef>
+
+
+#define JOBPRIORITY_URGENT (-FLT_MAX)
+#define JOBPRIORITY_NORMAL 0.0f
+
+class Job
+{
+    public:
+        virtual ~Job(void) {}
+
+        // This must be thread-safe.
+        virtual void Run(void) = 0;
+
+        // Used by BudgetedJobRunner, lowest value runs first.
+        virtual float GetPriority(void) const { return JOBPRIORITY_NORMAL; }
+
+        // Number of bytes that the job sends to the GL, used by BudgetedJobRunner.
+        virtual size_t GetUploadSize(void) const { return 0; }
+};
+
+#define QUEUE_DEFAULT_CAPACITY 16384
+
+/**
+ *  Lock-free, multiple producers and multiple consumers.
+ *  When the ring is full, jobs go to a locked overflow list, so that Add never waits:
+ *  scenes add all their init jobs before any thread takes from the queue.
+ */
+class Queue
+{
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            Job *pJob;
+        };
+
+        const size_t mask;
+        std::unique_ptr<Slot[]> mSlots;
+
+        // On separate cache lines, so that producers and consumers don't slow each other down.
+        alignas(64) std::atomic<size_t> enqueuePos;
+        alignas(64) std::atomic<size_t> dequeuePos;
+
+        // Taken from once the ring is empty.
+        std::mutex mtxOverflow;
+        std::deque<Job *> mOverflow;
+        std::atomic<size_t> countOverflow;
+
+        bool TryAdd(Job *);
+        Job *TryTake(void);
+
+        Queue(const Queue &) = delete;
+        void operator=(const Queue &) = delete;
+    public:
+        Queue(const size_t capacity = QUEUE_DEFAULT_CAPACITY);  // must be a power of two
+        ~Queue(void);  // Deletes the remaining jobs.
+
+        std::unique_ptr<Job> Take(void);  // NULL if empty.
+        void Add(std::unique_ptr<Job>);
+        void Add(Job *);  // Gets deleted automatically.
+        size_t Size(void) const;  // Approximate, while other threads are adding or taking.
+};
+
+#endif  // QUEUE_HPP
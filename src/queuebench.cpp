@@ -0,0 +1,169 @@
+/**
+ *  Compares the job queue with the locked list that it replaced:
+ *
+ *      queuebench [jobs]
+ *
+ *  For 1 to 16 threads, as many producers as consumers pass the jobs through each queue.
+ *  Then, like a scene's init, all jobs are added before anything takes from the queue.
+ */
+
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <string>
+
+#include <boost/format.hpp>
+
+#include "queue.hpp"
+#include "error.hpp"
+
+
+// The queue before the ring buffer.
+class LockedQueue
+{
+    private:
+        std::recursive_mutex mtxJobs;
+        std::list<std::shared_ptr<Job>> mJobs;
+    public:
+        std::shared_ptr<Job> Take(void)
+        {
+            std::shared_ptr<Job> pJob;
+            std::scoped_lock lock(mtxJobs);
+            if (mJobs.size() > 0)
+            {
+                pJob = mJobs.front();
+                mJobs.pop_front();
+            }
+            return pJob;
+        }
+        void Add(Job *pJob)
+        {
+            std::scoped_lock lock(mtxJobs);
+            mJobs.push_back(std::shared_ptr<Job>(pJob));
+        }
+};
+
+class CountJob: public Job
+{
+    private:
+        std::atomic<size_t> *pCount;
+    public:
+        CountJob(std::atomic<size_t> &count)
+        : pCount(&count)
+        {
+        }
+
+        void Run(void)
+        {
+            (*pCount)++;
+        }
+};
+
+// Returns millions of jobs per second.
+template <class QueueType>
+double Bench(QueueType &queue, const size_t countThreads, const size_t countJobs)
+{
+    std::atomic<size_t> countRun(0);
+    std::vector<std::thread> threads;
+    size_t i;
+
+    std::chrono::time_point<std::chrono::steady_clock> startTime = std::chrono::steady_clock::now();
+
+    for (i = 0; i < countThreads; i++)
+    {
+        size_t count = countJobs / countThreads + (i < (countJobs % countThreads) ? 1 : 0);
+        threads.emplace_back([&queue, &countRun, count]()
+        {
+            size_t j;
+            for (j = 0; j < count; j++)
+                queue.Add(new CountJob(countRun));
+        });
+    }
+
+    for (i = 0; i < countThreads; i++)
+    {
+        threads.emplace_back([&queue, &countRun, countJobs]()
+        {
+            while (countRun.load() < countJobs)
+            {
+                auto pJob = queue.Take();
+                if (pJob != NULL)
+                    pJob->Run();
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return countJobs / seconds / 1e6;
+}
+
+/**
+ *  Adds countJobs to a queue with no consumer, past its capacity, then takes them all.
+ *  Returns millions of jobs per second, or throws if jobs got lost.
+ */
+double BenchOverflow(const size_t countJobs)
+{
+    Queue queue;
+    std::atomic<size_t> countRun(0);
+    size_t i;
+
+    std::chrono::time_point<std::chrono::steady_clock> startTime = std::chrono::steady_clock::now();
+
+    for (i = 0; i < countJobs; i++)
+        queue.Add(new CountJob(countRun));
+
+    if (queue.Size() != countJobs)
+        throw RuntimeError("queue holds %u of %u jobs", (unsigned int)queue.Size(), (unsigned int)countJobs);
+
+    std::unique_ptr<Job> pJob;
+    while ((pJob = queue.Take()) != NULL)
+        pJob->Run();
+
+    if (countRun.load() != countJobs)
+        throw RuntimeError("%u of %u jobs came out of the queue", (unsigned int)countRun.load(), (unsigned int)countJobs);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return countJobs / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t countJobs = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    std::cout << "jobs: " << countJobs << ", throughput in millions of jobs per second" << std::endl;
+    std::cout << "threads  locked list  ring" << std::endl;
+
+    for (size_t countThreads : {1, 2, 4, 8, 16})
+    {
+        LockedQueue lockedQueue;
+        Queue ring;
+
+        double locked = Bench(lockedQueue, countThreads, countJobs),
+               lockFree = Bench(ring, countThreads, countJobs);
+
+        std::cout << boost::format("%7u  %11.2f  %4.2f") % countThreads % locked % lockFree << std::endl;
+    }
+
+    // More than fits in the ring, as many as a large view distance makes at init.
+    size_t countInit = 4 * QUEUE_DEFAULT_CAPACITY;
+    try
+    {
+        std::cout << boost::format("%u jobs without a consumer: %.2f") % countInit % BenchOverflow(countInit) << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "resource.hpp"
+#include "error.hpp"
+
+
+#ifdef _WIN32
+MappedFile::MappedFile(const boost::filesystem::path &path)
+: pData(NULL), size(0), hFile(INVALID_HANDLE_VALUE), hMapping(NULL)
+{
+    hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        throw IOError("Cannot open %s", path.string().c_str());
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        CloseHandle(hFile);
+        throw IOError("Cannot get the size of %s", path.string().c_str());
+    }
+    size = fileSize.QuadPart;
+
+    // Empty files can't be mapped.
+    if (size <= 0)
+        return;
+
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping != NULL)
+        pData = (const char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (pData == NULL)
+    {
+        if (hMapping != NULL)
+            CloseHandle(hMapping);
+        CloseHandle(hFile);
+        throw IOError("Cannot map %s", path.string().c_str());
+    }
+}
+MappedFile::~MappedFile(void)
+{
+    if (pData != NULL)
+        UnmapViewOfFile(pData);
+    if (hMapping != NULL)
+        CloseHandle(hMapping);
+    CloseHandle(hFile);
+}
+#else
+MappedFile::MappedFile(const boost::filesystem::path &path)
+: pData(NULL), size(0)
+{
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        throw IOError("Cannot open %s", path.string().c_str());
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw IOError("Cannot get the size of %s", path.string().c_str());
+    }
+    size = info.st_size;
+
+    // Empty files can't be mapped.
+    if (size > 0)
+    {
+        void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            throw IOError("Cannot map %s", path.string().c_str());
+        }
+
+        // Loaders read from front to back.
+        madvise(p, size, MADV_SEQUENTIAL);
+
+        pData = (const char *)p;
+    }
+
+    // The mapping keeps the file open.
+    close(fd);
+}
+MappedFile::~MappedFile(void)
+{
+    if (pData != NULL)
+        munmap((void *)pData, size);
+}
+#endif
+const char *MappedFile::GetData(void) const
+{
+    return pData;
+}
+size_t MappedFile::GetSize(void) const
+{
+    return size;
+}
+SpanBuffer::SpanBuffer(const char *pData, const size_t size)
+{
+    // The get area is never written to.
+    char *p = const_cast<char *>(pData);
+    setg(p, p, p + size);
+}
+SpanBuffer::pos_type SpanBuffer::seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+    char *p;
+    if (dir == std::ios_base::beg)
+        p = eback() + offset;
+    else if (dir == std::ios_base::cur)
+        p = gptr() + offset;
+    else
+        p = egptr() + offset;
+
+    if (!(which & std::ios_base::in) || p < eback() || p > egptr())
+        return pos_type(off_type(-1));
+
+    setg(eback(), p, egptr());
+    return pos_type(p - eback());
+}
+SpanBuffer::pos_type SpanBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+SpanStream::SpanStream(const Resource &resource)
+: std::istream(NULL), mBuffer(resource.GetData(), resource.GetSize())
+{
+    rdbuf(&mBuffer);
+}
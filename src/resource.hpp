@@ -0,0 +1,66 @@
+#ifndef RESOURCE_HPP
+#define RESOURCE_HPP
+
+#include <memory>
+#include <streambuf>
+#include <istream>
+
+#include <boost/filesystem.hpp>
+
+
+/**
+ *  A contiguous, read-only span of bytes, that stays valid as long as the object exists.
+ */
+class Resource
+{
+    public:
+        virtual ~Resource(void) {}
+
+        virtual const char *GetData(void) const = 0;
+        virtual size_t GetSize(void) const = 0;
+};
+
+/**
+ *  A whole file, mapped in memory. Throws IOError if it can't be opened.
+ */
+class MappedFile: public Resource
+{
+    private:
+        const char *pData;
+        size_t size;
+
+#ifdef _WIN32
+        void *hFile, *hMapping;  // HANDLEs, windows.h isn't included here
+#endif
+
+        MappedFile(const MappedFile &) = delete;
+        void operator=(const MappedFile &) = delete;
+    public:
+        MappedFile(const boost::filesystem::path &);
+        ~MappedFile(void);
+
+        const char *GetData(void) const;
+        size_t GetSize(void) const;
+};
+
+/**
+ *  For parsers that want a stream. Reads straight from the span, without copying it.
+ */
+class SpanBuffer: public std::streambuf
+{
+    protected:
+        pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode);
+        pos_type seekpos(pos_type, std::ios_base::openmode);
+    public:
+        SpanBuffer(const char *pData, const size_t size);
+};
+
+class SpanStream: public std::istream
+{
+    private:
+        SpanBuffer mBuffer;
+    public:
+        SpanStream(const Resource &);
+};
+
+#endif  // RESOURCE_HPP
@@ -0,0 +1,217 @@
+#include <algorithm>
+
+#include "s3tc.hpp"
+
+
+#define COUNT_BLOCK_PIXELS (S3TC_BLOCK_WIDTH * S3TC_BLOCK_WIDTH)
+
+uint16_t PackRGB565(const int r, const int g, const int b)
+{
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+void UnpackRGB565(const uint16_t c, int *rgb)
+{
+    int r = (c >> 11) & 0x1f,
+        g = (c >> 5) & 0x3f,
+        b = c & 0x1f;
+
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+void WriteUInt16(const uint16_t v, uint8_t *out)
+{
+    out[0] = v & 0xff;
+    out[1] = v >> 8;
+}
+
+/**
+ *  Uses the corners of the color bounding box as end points,
+ *  moved inwards a little, since the extremes are rarely hit exactly.
+ */
+void CompressColorBlock(const uint8_t *pixels, uint8_t *out)
+{
+    int min[3] = {255, 255, 255},
+        max[3] = {0, 0, 0},
+        inset, palette[4][3],
+        i, c, j, d, best, bestDist;
+
+    for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            min[c] = std::min(min[c], int(pixels[4 * i + c]));
+            max[c] = std::max(max[c], int(pixels[4 * i + c]));
+        }
+    }
+
+    for (c = 0; c < 3; c++)
+    {
+        inset = (max[c] - min[c]) / 16;
+        min[c] += inset;
+        max[c] -= inset;
+    }
+
+    /*  Pick the diagonal of the box that the colors lie along: a channel that
+        goes down while the widest channel goes up, must have its ends swapped.
+     */
+    int widest = 0, mean[3] = {0, 0, 0}, covariance;
+    for (c = 1; c < 3; c++)
+        if ((max[c] - min[c]) > (max[widest] - min[widest]))
+            widest = c;
+
+    for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+        for (c = 0; c < 3; c++)
+            mean[c] += pixels[4 * i + c];
+
+    for (c = 0; c < 3; c++)
+    {
+        if (c == widest)
+            continue;
+
+        covariance = 0;
+        for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+            covariance += (COUNT_BLOCK_PIXELS * pixels[4 * i + widest] - mean[widest]) *
+                          (COUNT_BLOCK_PIXELS * pixels[4 * i + c] - mean[c]);
+
+        if (covariance < 0)
+            std::swap(min[c], max[c]);
+    }
+
+    uint16_t c0 = PackRGB565(max[0], max[1], max[2]),
+             c1 = PackRGB565(min[0], min[1], min[2]);
+
+    // c0 > c1 selects the four color mode.
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    UnpackRGB565(c0, palette[0]);
+    UnpackRGB565(c1, palette[1]);
+    for (c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+        {
+            best = 0;
+            bestDist = -1;
+            for (j = 0; j < 4; j++)
+            {
+                d = 0;
+                for (c = 0; c < 3; c++)
+                    d += (pixels[4 * i + c] - palette[j][c]) * (pixels[4 * i + c] - palette[j][c]);
+
+                if (bestDist < 0 || d < bestDist)
+                {
+                    bestDist = d;
+                    best = j;
+                }
+            }
+
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    WriteUInt16(c0, out);
+    WriteUInt16(c1, out + 2);
+    out[4] = indices & 0xff;
+    out[5] = (indices >> 8) & 0xff;
+    out[6] = (indices >> 16) & 0xff;
+    out[7] = indices >> 24;
+}
+void CompressAlphaBlock(const uint8_t *pixels, uint8_t *out)
+{
+    int a0 = 0, a1 = 255, palette[8],
+        i, j, d, best, bestDist;
+
+    for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+    {
+        a0 = std::max(a0, int(pixels[4 * i + 3]));
+        a1 = std::min(a1, int(pixels[4 * i + 3]));
+    }
+
+    // a0 > a1 selects the eight alpha mode.
+    palette[0] = a0;
+    palette[1] = a1;
+    for (j = 1; j < 7; j++)
+        palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+
+    uint64_t indices = 0;
+    if (a0 != a1)
+    {
+        for (i = 0; i < COUNT_BLOCK_PIXELS; i++)
+        {
+            best = 0;
+            bestDist = -1;
+            for (j = 0; j < 8; j++)
+            {
+                d = std::abs(int(pixels[4 * i + 3]) - palette[j]);
+                if (bestDist < 0 || d < bestDist)
+                {
+                    bestDist = d;
+                    best = j;
+                }
+            }
+
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (i = 0; i < 6; i++)
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+void CompressBlockDXT1(const uint8_t *pixels, uint8_t *out)
+{
+    CompressColorBlock(pixels, out);
+}
+void CompressBlockDXT5(const uint8_t *pixels, uint8_t *out)
+{
+    CompressAlphaBlock(pixels, out);
+    CompressColorBlock(pixels, out + 8);
+}
+size_t CountS3TCBytes(const size_t width, const size_t height, const size_t blockSize)
+{
+    return ((width + S3TC_BLOCK_WIDTH - 1) / S3TC_BLOCK_WIDTH) *
+           ((height + S3TC_BLOCK_WIDTH - 1) / S3TC_BLOCK_WIDTH) * blockSize;
+}
+void CompressImage(const uint8_t *rgba, const size_t width, const size_t height, uint8_t *out,
+                   const size_t blockSize, void (*compressBlock)(const uint8_t *, uint8_t *))
+{
+    uint8_t block[4 * COUNT_BLOCK_PIXELS];
+    size_t bx, by, x, y, px, py;
+
+    for (by = 0; by < height; by += S3TC_BLOCK_WIDTH)
+    {
+        for (bx = 0; bx < width; bx += S3TC_BLOCK_WIDTH)
+        {
+            for (y = 0; y < S3TC_BLOCK_WIDTH; y++)
+            {
+                py = std::min(by + y, height - 1);
+                for (x = 0; x < S3TC_BLOCK_WIDTH; x++)
+                {
+                    px = std::min(bx + x, width - 1);
+                    std::copy(rgba + 4 * (py * width + px), rgba + 4 * (py * width + px + 1),
+                              block + 4 * (y * S3TC_BLOCK_WIDTH + x));
+                }
+            }
+
+            compressBlock(block, out);
+            out += blockSize;
+        }
+    }
+}
+void CompressImageDXT1(const uint8_t *rgba, const size_t width, const size_t height, uint8_t *out)
+{
+    CompressImage(rgba, width, height, out, S3TC_DXT1_BLOCK_SIZE, CompressBlockDXT1);
+}
+void CompressImageDXT5(const uint8_t *rgba, const size_t width, const size_t height, uint8_t *out)
+{
+    CompressImage(rgba, width, height, out, S3TC_DXT5_BLOCK_SIZE, CompressBlockDXT5);
+}
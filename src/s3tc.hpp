@@ -0,0 +1,28 @@
+#ifndef S3TC_HPP
+#define S3TC_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+
+#define S3TC_BLOCK_WIDTH 4
+#define S3TC_DXT1_BLOCK_SIZE 8
+#define S3TC_DXT5_BLOCK_SIZE 16
+
+/**
+ *  Block compressors, the input is 4 x 4 RGBA pixels, row by row.
+ *  DXT1 ignores the alpha.
+ */
+void CompressBlockDXT1(const uint8_t *pixels, uint8_t *out);
+void CompressBlockDXT5(const uint8_t *pixels, uint8_t *out);
+
+/**
+ *  Compresses a whole RGBA image. Edge blocks repeat the last row or column.
+ *  The output must have room for CountS3TCBytes.
+ */
+void CompressImageDXT1(const uint8_t *rgba, const size_t width, const size_t height, uint8_t *out);
+void CompressImageDXT5(const uint8_t *rgba, const size_t width, const size_t height, uint8_t *out);
+
+size_t CountS3TCBytes(const size_t width, const size_t height, const size_t blockSize);
+
+#endif  // S3TC_HPP
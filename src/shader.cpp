@@ -1,6 +1,13 @@
 #include <iostream>
 #include <memory>
 #include <list>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/format.hpp>
 
 #include "shader.hpp"
 #include "app.hpp"
@@ -29,11 +36,8 @@ std::string getShaderTypeName(const GLenum type)
     };
 }
 
-GLuint MakeShader(const std::string &source, const GLenum type)
+GLuint SubmitShader(const std::string &source, const GLenum type)
 {
-    GLint result;
-    int logLength;
-
     GLuint shader = glCreateShader(type);
     CHECK_GL();
 
@@ -44,11 +48,21 @@ GLuint MakeShader(const std::string &source, const GLenum type)
     glCompileShader(shader);
     CHECK_GL();
 
+    return shader;
+}
+void CheckShader(const GLuint shader)
+{
+    GLint result, type;
+    int logLength;
+
     glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
     CHECK_GL();
 
     if (result != GL_TRUE)
     {
+        glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+        CHECK_GL();
+
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
         CHECK_GL();
 
@@ -56,21 +70,31 @@ GLuint MakeShader(const std::string &source, const GLenum type)
         glGetShaderInfoLog(shader, logLength, NULL, errorString.get());
         CHECK_GL();
 
+        throw ShaderError("error while compiling %s: %s", getShaderTypeName(type).c_str(), errorString.get());
+    }
+}
+GLuint MakeShader(const std::string &source, const GLenum type)
+{
+    GLuint shader = SubmitShader(source, type);
+
+    try
+    {
+        CheckShader(shader);
+    }
+    catch (...)
+    {
         glDeleteShader(shader);
         CHECK_GL();
 
-        throw ShaderError("error while compiling %s: %s", getShaderTypeName(type).c_str(), errorString.get());
+        throw;
     }
 
     return shader;
 }
-void LinkShaders(const GLuint program,
-                 const std::list<GLuint> &shaders,
-                 const VertexAttributeMap &vertexAttribLocations)
+void SubmitLink(const GLuint program,
+                const std::list<GLuint> &shaders,
+                const VertexAttributeMap &vertexAttribLocations)
 {
-    GLint result;
-    int logLength;
-
     for (GLuint shader : shaders)
     {
         glAttachShader(program, shader);
@@ -86,6 +110,11 @@ void LinkShaders(const GLuint program,
 
     glLinkProgram(program);
     CHECK_GL();
+}
+void CheckLink(const GLuint program)
+{
+    GLint result;
+    int logLength;
 
     glGetProgramiv(program, GL_LINK_STATUS, &result);
     CHECK_GL();
@@ -102,6 +131,13 @@ void LinkShaders(const GLuint program,
         throw ShaderError("error while linking shaders: %s", errorString.get());
     }
 }
+void LinkShaders(const GLuint program,
+                 const std::list<GLuint> &shaders,
+                 const VertexAttributeMap &vertexAttribLocations)
+{
+    SubmitLink(program, shaders, vertexAttribLocations);
+    CheckLink(program);
+}
 void LinkShaders(const GLuint program,
                  const GLuint vertexShader,
                  const GLuint fragmentShader, const VertexAttributeMap &attributes)
@@ -131,43 +167,266 @@ ShaderError::ShaderError(const char *format, ...)
     va_end(pArgs);
 }
 
-ShaderLoadJob::ShaderLoadJob(GLuint prg,
+ShaderLoadJob::ShaderLoadJob(ShaderProgram &prg,
                              const std::string &vSrc,
                              const std::string &fSrc,
-                             const VertexAttributeMap &attrs)
-: program(prg), vertexSrc(vSrc), geometrySrc(""), fragmentSrc(fSrc), attributes(attrs)
+                             const VertexAttributeMap &attrs,
+                             const UniformBlockBindingMap &blocks)
+: pProgram(&prg), vertexSrc(vSrc), geometrySrc(""), fragmentSrc(fSrc), attributes(attrs), blockBindings(blocks),
+  submitted(false), cached(false)
 {
 }
-ShaderLoadJob::ShaderLoadJob(GLuint prg,
+ShaderLoadJob::ShaderLoadJob(ShaderProgram &prg,
                              const std::string &vSrc,
                              const std::string &gSrc,
                              const std::string &fSrc,
-                             const VertexAttributeMap &attrs)
-: program(prg), vertexSrc(vSrc), geometrySrc(gSrc), fragmentSrc(fSrc), attributes(attrs)
+                             const VertexAttributeMap &attrs,
+                             const UniformBlockBindingMap &blocks)
+: pProgram(&prg), vertexSrc(vSrc), geometrySrc(gSrc), fragmentSrc(fSrc), attributes(attrs), blockBindings(blocks),
+  submitted(false), cached(false)
 {
 }
-void DeleteShader(GLuint shader)
+// FNV-1a, 64 bits.
+uint64_t HashString(uint64_t hash, const std::string &s)
+{
+    for (char c : s)
+    {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    // Separate the strings, so that "ab" + "c" differs from "a" + "bc".
+    hash ^= 0xff;
+    hash *= 0x100000001b3ULL;
+
+    return hash;
+}
+std::string GetGLString(const GLenum name)
 {
-    glDeleteShader(shader);
+    const GLubyte *s = glGetString(name);
     CHECK_GL();
+
+    return std::string((const char *)s);
 }
-void ShaderLoadJob::Run(void)
+bool CanCacheProgramBinaries(void)
+{
+    if (!GLEW_ARB_get_program_binary)
+        return false;
+
+    GLint countFormats;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &countFormats);
+    CHECK_GL();
+
+    return countFormats > 0;
+}
+std::string GetProgramCacheLocation(const std::string &key)
+{
+    return "shadercache/" + key + ".bin";
+}
+boost::filesystem::path GetProgramCachePath(const std::string &key)
+{
+    return App::Instance().GetResourcePath(GetProgramCacheLocation(key));
+}
+std::string ShaderLoadJob::GetCacheKey(void) const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = HashString(hash, GetGLString(GL_VENDOR));
+    hash = HashString(hash, GetGLString(GL_RENDERER));
+    hash = HashString(hash, GetGLString(GL_VERSION));
+
+    hash = HashString(hash, vertexSrc);
+    hash = HashString(hash, geometrySrc);
+    hash = HashString(hash, fragmentSrc);
+
+    for (const auto &pair : attributes)
+    {
+        hash = HashString(hash, std::get<0>(pair));
+        hash = HashString(hash, std::to_string(std::get<1>(pair)));
+    }
+
+    return (boost::format("%016x") % hash).str();
+}
+/**
+ *  The file holds the binary format, followed by the binary.
+ *  Returns false if there's no such file or if the driver rejects it.
+ */
+bool ShaderLoadJob::LoadBinary(const std::string &key)
 {
+    boost::filesystem::path path = GetProgramCachePath(key);
+    boost::system::error_code ec;
+
+    if (!boost::filesystem::exists(path, ec))
+        return false;
+
+    std::shared_ptr<const Resource> pResource = App::Instance().OpenResource(GetProgramCacheLocation(key));
+    if (pResource->GetSize() <= sizeof(GLenum))
+        return false;
+
+    GLenum format;
+    memcpy(&format, pResource->GetData(), sizeof(format));
+
+    glProgramBinary(**pProgram, format, pResource->GetData() + sizeof(format), pResource->GetSize() - sizeof(format));
+
+    /*
+     *  A driver update can make the format unknown or the binary invalid, that's not an error here.
+     *  Any other error is.
+     */
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR && err != GL_INVALID_ENUM && err != GL_INVALID_VALUE)
+        throw GLError(err, __FILE__, __LINE__);
+
+    GLint result = GL_FALSE;
+    if (err == GL_NO_ERROR)
+    {
+        glGetProgramiv(**pProgram, GL_LINK_STATUS, &result);
+        CHECK_GL();
+    }
+
+    if (result != GL_TRUE)
+    {
+        pResource.reset();
+        boost::filesystem::remove(path, ec);
+        return false;
+    }
+
+    return true;
+}
+// Failing to write the cache isn't fatal, the next launch just compiles again.
+void ShaderLoadJob::SaveBinary(const std::string &key)
+{
+    boost::filesystem::path path = GetProgramCachePath(key);
+    boost::system::error_code ec;
+
+    GLint length;
+    glGetProgramiv(**pProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+    CHECK_GL();
+
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(**pProgram, length, NULL, &format, binary.data());
+    CHECK_GL();
+
+    boost::filesystem::create_directories(path.parent_path(), ec);
+    if (ec)
+    {
+        std::cerr << "cannot create " << path.parent_path().string() << ": " << ec.message() << std::endl;
+        return;
+    }
+
+    boost::filesystem::ofstream os(path, std::ios::binary);
+    os.write((const char *)&format, sizeof(format));
+    os.write(binary.data(), binary.size());
+    if (!os.good())
+    {
+        std::cerr << "cannot write " << path.string() << std::endl;
+        os.close();
+        boost::filesystem::remove(path, ec);
+    }
+}
+void ShaderLoadJob::Submit(void)
+{
+    submitted = true;
+
+    if (CanCacheProgramBinaries())
+    {
+        cacheKey = GetCacheKey();
+
+        cached = LoadBinary(cacheKey);
+        if (cached)
+            return;
+
+        glProgramParameteri(**pProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        CHECK_GL();
+    }
+
+    mShaders.push_back(SubmitShader(vertexSrc, GL_VERTEX_SHADER));
     if (geometrySrc.length() > 0)
+        mShaders.push_back(SubmitShader(geometrySrc, GL_GEOMETRY_SHADER));
+    mShaders.push_back(SubmitShader(fragmentSrc, GL_FRAGMENT_SHADER));
+
+    SubmitLink(**pProgram, mShaders, attributes);
+}
+bool ShaderLoadJob::IsCompleted(void) const
+{
+    if (cached || !GLEW_KHR_parallel_shader_compile)
+        return true;
+
+    // The link waits for the compiles, so this covers them too.
+    GLint completed;
+    glGetProgramiv(**pProgram, GL_COMPLETION_STATUS_KHR, &completed);
+    CHECK_GL();
+
+    return completed == GL_TRUE;
+}
+void ShaderLoadJob::Finish(void)
+{
+    if (!cached)
+    {
+        try
+        {
+            for (GLuint shader : mShaders)
+                CheckShader(shader);
+
+            CheckLink(**pProgram);
+        }
+        catch (...)
+        {
+            DeleteShaders();
+            throw;
+        }
+
+        DeleteShaders();
+
+        if (cacheKey.length() > 0)
+            SaveBinary(cacheKey);
+    }
+
+    // Not part of the binary.
+    for (const auto &pair : blockBindings)
     {
-        GLScoped scopedVertexShader(MakeShader(vertexSrc, GL_VERTEX_SHADER), DeleteShader),
-                 scopedGeometryShader(MakeShader(geometrySrc, GL_GEOMETRY_SHADER), DeleteShader),
-                 scopedFragmentShader(MakeShader(fragmentSrc, GL_FRAGMENT_SHADER), DeleteShader);
+        GLuint index = glGetUniformBlockIndex(**pProgram, std::get<0>(pair).c_str());
+        CHECK_GL();
 
-        LinkShaders(program, *scopedVertexShader,
-                             *scopedGeometryShader,
-                             *scopedFragmentShader, attributes);
+        if (index == GL_INVALID_INDEX)
+            throw ShaderError("No active uniform block %s", std::get<0>(pair).c_str());
+
+        glUniformBlockBinding(**pProgram, index, std::get<1>(pair));
+        CHECK_GL();
     }
-    else
+
+    pProgram->Reflect();
+}
+void ShaderLoadJob::DeleteShaders(void)
+{
+    for (GLuint shader : mShaders)
     {
-        GLScoped scopedVertexShader(MakeShader(vertexSrc, GL_VERTEX_SHADER), DeleteShader),
-                 scopedFragmentShader(MakeShader(fragmentSrc, GL_FRAGMENT_SHADER), DeleteShader);
+        glDeleteShader(shader);
+        CHECK_GL();
+    }
+    mShaders.clear();
+}
+void ShaderLoadJob::Run(void)
+{
+    if (!submitted)
+        Submit();
 
-        LinkShaders(program, *scopedVertexShader, *scopedFragmentShader, attributes);
+    // Rather than waiting for the driver, come back next frame.
+    if (!IsCompleted())
+    {
+        App::Instance().PushGL(new ShaderLoadJob(std::move(*this)));
+        return;
     }
+
+    Finish();
+}
+void ShaderLoadJob::RunNow(void)
+{
+    if (!submitted)
+        Submit();
+
+    Finish();
 }
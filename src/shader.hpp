@@ -2,18 +2,31 @@
 #define SHADER_HPP
 
 #include <map>
+#include <list>
+#include <string>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
 
 #include "error.hpp"
 #include "load.hpp"
+#include "alloc.hpp"
 
 
 typedef std::map<std::string, size_t> VertexAttributeMap;
 
+// Uniform block names, mapped to their binding points.
+typedef std::map<std::string, GLuint> UniformBlockBindingMap;
+
 
 GLuint MakeShader(const std::string &src, const GLenum type);
+
+// These don't wait for the driver, the Check functions do.
+GLuint SubmitShader(const std::string &src, const GLenum type);
+void CheckShader(const GLuint shader);
+void SubmitLink(const GLuint program,
+                const std::list<GLuint> &shaders, const VertexAttributeMap &);
+void CheckLink(const GLuint program);
 void LinkShaders(const GLuint shaderProgram,
                  const GLuint vertexShader,
                  const GLuint fragmentShader, const VertexAttributeMap &);
@@ -29,25 +42,53 @@ class ShaderError: public Error
 };
 
 
+/**
+ *  Looks for a linked binary of the program in the cache first,
+ *  and stores the binary there after compiling.
+ *
+ *  With KHR_parallel_shader_compile, the job pushes itself back to the GL queue
+ *  until the driver is done, so that other jobs and frames aren't held up.
+ */
 class ShaderLoadJob: public Job
 {
     private:
         std::string vertexSrc, geometrySrc, fragmentSrc;
         VertexAttributeMap attributes;
-        GLuint program;
+        UniformBlockBindingMap blockBindings;
+        ShaderProgram *pProgram;
+
+        bool submitted, cached;
+        std::string cacheKey;
+        std::list<GLuint> mShaders;  // compiling
+
+        // Identifies the sources, attributes and driver.
+        std::string GetCacheKey(void) const;
+
+        bool LoadBinary(const std::string &key);
+        void SaveBinary(const std::string &key);
+
+        void Submit(void);
+        bool IsCompleted(void) const;
+        void Finish(void);
+        void DeleteShaders(void);
     public:
-        ShaderLoadJob(GLuint program,
+        ShaderLoadJob(ShaderProgram &program,
                       const std::string &vertexSrc,
                       const std::string &fragmentSrc,
-                      const VertexAttributeMap &attributes);
+                      const VertexAttributeMap &attributes,
+                      const UniformBlockBindingMap &blockBindings = UniformBlockBindingMap());
 
-        ShaderLoadJob(GLuint program,
+        ShaderLoadJob(ShaderProgram &program,
                       const std::string &vertexSrc,
                       const std::string &geometrySrc,
                       const std::string &fragmentSrc,
-                      const VertexAttributeMap &attributes);
+                      const VertexAttributeMap &attributes,
+                      const UniformBlockBindingMap &blockBindings = UniformBlockBindingMap());
 
         void Run(void);
+
+        // Waits for the driver, instead of pushing itself back.
+        void RunNow(void);
 };
 
 #endif  // SHADER_HPP
@@ -6,40 +6,30 @@
 #include "sky.hpp"
 #include "error.hpp"
 #include "shader.hpp"
+#include "frame.hpp"
 
 
-const char skyVertexShaderSrc[] = R"shader(
-#version 150
-
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
-
+const char skyVertexShaderSrc[] = "#version 150\n" FRAME_UNIFORM_BLOCK_GLSL R"shader(
 in vec3 position;
 
 out vec3 onSpherePosition;
 
 void main()
 {
-    gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0);
+    // The sky doesn't move along with the camera.
+    gl_Position = projectionMatrix * mat4(mat3(viewMatrix)) * vec4(position, 1.0);
     onSpherePosition = position;
 }
 )shader",
 
-skyFragmentShaderSrc[] = R"shader(
-#version 150
-
-uniform float heightAboveHorizon;
-uniform float horizonDistance;
-uniform vec4 skyColor;
-uniform vec4 horizonColor;
-
+skyFragmentShaderSrc[] = "#version 150\n" FRAME_UNIFORM_BLOCK_GLSL R"shader(
 in vec3 onSpherePosition;
 
 out vec4 fragColor;
 
 void main()
 {
-    float f = clamp(onSpherePosition.y + heightAboveHorizon / horizonDistance, 0.0, 1.0);
+    float f = clamp(onSpherePosition.y + center.y / horizonDistance, 0.0, 1.0);
     f = sqrt(f);
     fragColor = (1.0 - f) * horizonColor + f * skyColor;
 }
@@ -67,6 +57,8 @@ void SetSkySphere(const GLuint vertexBuffer, const GLuint indexBuffer,
                   const float radius,
                   const size_t lattitudes, const size_t longitudes)
 {
+    GLState *pState = App::Instance().GetGLState();
+
     size_t i, j, jnext,
            countIndices = 0,
            countPoints = CountSpherePoints(lattitudes, longitudes),
@@ -74,13 +66,11 @@ void SetSkySphere(const GLuint vertexBuffer, const GLuint indexBuffer,
 
     float phi, theta;
 
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, countPoints * sizeof(SkyVertex), NULL, GL_STATIC_DRAW);
     CHECK_GL();
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * countTriangles * sizeof(SkyIndex), NULL, GL_STATIC_DRAW);
     CHECK_GL();
 
@@ -164,99 +154,40 @@ void SkyRenderer::TellInit(Queue &)
 
     VertexAttributeMap attributes;
     attributes["position"] = SKY_POSITION_INDEX;
-    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
-    App::Instance().PushGL(new ShaderLoadJob(*pProgram, skyVertexShaderSrc, skyFragmentShaderSrc, attributes));
+    UniformBlockBindingMap blocks;
+    blocks[FRAME_UNIFORM_BLOCK_NAME] = FRAME_UNIFORMS_BINDING;
+    mProgram.Alloc();
+    App::Instance().PushGL(new ShaderLoadJob(mProgram, skyVertexShaderSrc, skyFragmentShaderSrc, attributes, blocks));
 }
 
-void SkyRenderer::Render(const mat4 &projection, const mat4 &view,
-                         const float heightAboveHorizon,
-                         const vec4 &horizonColor, const vec4 &skyColor)
+void SkyRenderer::Render(void)
 {
-    Config config;
-    App::Instance().GetConfig(config);
+    GLState *pState = App::Instance().GetGLState();
 
-    glDisable(GL_DEPTH_TEST);
-    CHECK_GL();
+    pState->Disable(GL_DEPTH_TEST);
 
-    glDepthMask(GL_FALSE);
-    CHECK_GL();
+    pState->DepthMask(GL_FALSE);
 
-    glEnable(GL_CULL_FACE);
-    CHECK_GL();
+    pState->Enable(GL_CULL_FACE);
 
-    glUseProgram(*pProgram);
-    CHECK_GL();
+    mProgram.Use();
 
-    glBindBuffer(GL_ARRAY_BUFFER, *pSkyVertexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pSkyVertexBuffer);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pSkyIndexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pSkyIndexBuffer);
 
     glEnableVertexAttribArray(SKY_POSITION_INDEX);
     CHECK_GL();
     glVertexAttribPointer(SKY_POSITION_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(SkyVertex), 0);
     CHECK_GL();
 
-    GLint projectionMatrixLocation,
-          viewMatrixLocation,
-          heightAboveHorizonLocation,
-          horizonDistanceLocation,
-          horizonColorLocation,
-          skyColorLocation;
-
-    projectionMatrixLocation = glGetUniformLocation(*pProgram, "projectionMatrix");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(projectionMatrixLocation);
-
-    viewMatrixLocation = glGetUniformLocation(*pProgram, "viewMatrix");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(viewMatrixLocation);
-
-    heightAboveHorizonLocation = glGetUniformLocation(*pProgram, "heightAboveHorizon");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(heightAboveHorizonLocation);
-
-    horizonDistanceLocation = glGetUniformLocation(*pProgram, "horizonDistance");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(horizonDistanceLocation);
-
-    horizonColorLocation = glGetUniformLocation(*pProgram, "horizonColor");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(horizonColorLocation);
-
-    skyColorLocation = glGetUniformLocation(*pProgram, "skyColor");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(skyColorLocation);
-
-    glUniformMatrix4fv(projectionMatrixLocation, 1, GL_FALSE, value_ptr(projection));
-    CHECK_GL();
-
-    mat4 t = mat4(mat3(view));
-    glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, value_ptr(t));
-    CHECK_GL();
-
-    glUniform1f(horizonDistanceLocation, config.render.distance);
-    CHECK_GL();
-
-    glUniform1f(heightAboveHorizonLocation, heightAboveHorizon);
-    CHECK_GL();
-
-    glUniform4fv(horizonColorLocation, 1, value_ptr(horizonColor));
-    CHECK_GL();
-
-    glUniform4fv(skyColorLocation, 1, value_ptr(skyColor));
-    CHECK_GL();
-
     glDrawElements(GL_TRIANGLES, 3 * CountSphereTriangles(countLattitudes, countLongitudes), GL_UNSIGNED_INT, 0);
     CHECK_GL();
 
     glDisableVertexAttribArray(SKY_POSITION_INDEX);
     CHECK_GL();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    CHECK_GL();
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
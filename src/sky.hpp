@@ -13,16 +13,16 @@ class SkyRenderer: Initializable
     private:
         float radius;
         size_t countLongitudes, countLattitudes;
-        GLRef pSkyVertexBuffer, pSkyIndexBuffer,
-              pProgram;
+        GLRef pSkyVertexBuffer, pSkyIndexBuffer;
+        ShaderProgram mProgram;
     public:
         SkyRenderer(const size_t subdiv);
 
         void TellInit(Queue &);
 
         void SetHeight(const float y);
-        void Render(const mat4 &projection, const mat4 &view, const float heightAboveHorizon,
-                    const vec4 &horizonColor, const vec4 &skyColor);
+        // Uses the frame uniforms.
+        void Render(void);
 };
 
 
@@ -0,0 +1,120 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cmath>
+
+#include "synth.hpp"
+#include "texture.hpp"
+
+
+// The lowest octave repeats this many times over the texture, each next one twice as often.
+#define SAND_BASE_PERIOD 8
+#define COUNT_SAND_OCTAVES 6  // until the period is 256, which is as far as the lattice goes
+
+#define SAND_WARP_PERIOD 4
+#define COUNT_SAND_RIPPLES 24  // must be whole, for the texture to tile
+
+const vec3 sandDarkColor(0.835f, 0.820f, 0.729f),
+           sandLightColor(0.941f, 0.925f, 0.824f);
+
+struct SandSynthesis
+{
+    PerlinNoiseGenerator2D mNoiseGenerator;
+    std::vector<uint8_t> mPixels;  // RGBA
+    std::atomic<size_t> countBandsLeft;
+    GLuint texture;
+
+    SandSynthesis(const WorldSeed seed, const size_t countBands, const GLuint tex)
+    : mNoiseGenerator(seed), mPixels(4 * SAND_TEXTURE_SIZE * SAND_TEXTURE_SIZE),
+      countBandsLeft(countBands), texture(tex)
+    {
+    }
+};
+
+/**
+ *  Goes through the band row by row, one octave at a time,
+ *  so that the noise is evaluated in batches over a row.
+ */
+class SandBandSynthJob: public Job
+{
+    private:
+        std::shared_ptr<SandSynthesis> pSynthesis;
+        size_t firstRow, countRows;
+    public:
+        SandBandSynthJob(std::shared_ptr<SandSynthesis> p, const size_t first, const size_t count)
+        : pSynthesis(p), firstRow(first), countRows(count)
+        {
+        }
+
+        void Run(void)
+        {
+            const size_t n = SAND_TEXTURE_SIZE;
+            std::unique_ptr<float[]> xs(new float[n]),
+                                     ys(new float[n]),
+                                     noise(new float[n]),
+                                     total(new float[n]);
+            size_t x, y, octave;
+            int32_t period;
+            float v, amplitude, maxValue, ripple, t;
+
+            for (y = firstRow; y < (firstRow + countRows); y++)
+            {
+                v = (float(y) + 0.5f) / n;
+
+                std::fill(total.get(), total.get() + n, 0.0f);
+                amplitude = 1.0f;
+                maxValue = 0.0f;
+                for (octave = 0; octave < COUNT_SAND_OCTAVES; octave++)
+                {
+                    period = SAND_BASE_PERIOD << octave;
+                    for (x = 0; x < n; x++)
+                    {
+                        xs[x] = (float(x) + 0.5f) * period / n;
+                        ys[x] = v * period;
+                    }
+                    pSynthesis->mNoiseGenerator.BatchTiledNoise(xs.get(), ys.get(), noise.get(), n, period);
+
+                    for (x = 0; x < n; x++)
+                        total[x] += amplitude * noise[x];
+
+                    maxValue += amplitude;
+                    amplitude *= 0.5f;
+                }
+
+                // Wind ripples, bent by a slow noise.
+                for (x = 0; x < n; x++)
+                {
+                    xs[x] = (float(x) + 0.5f) * SAND_WARP_PERIOD / n;
+                    ys[x] = v * SAND_WARP_PERIOD;
+                }
+                pSynthesis->mNoiseGenerator.BatchTiledNoise(xs.get(), ys.get(), noise.get(), n, SAND_WARP_PERIOD);
+
+                uint8_t *pRow = pSynthesis->mPixels.data() + 4 * y * n;
+                for (x = 0; x < n; x++)
+                {
+                    ripple = std::sin(2 * pi<float>() * (COUNT_SAND_RIPPLES * v + 0.8f * noise[x]));
+                    t = clamp(0.5f + 0.5f * total[x] / maxValue + 0.12f * ripple, 0.0f, 1.0f);
+
+                    vec3 color = sandDarkColor + t * (sandLightColor - sandDarkColor);
+                    pRow[4 * x] = uint8_t(std::round(255 * color.x));
+                    pRow[4 * x + 1] = uint8_t(std::round(255 * color.y));
+                    pRow[4 * x + 2] = uint8_t(std::round(255 * color.z));
+                    pRow[4 * x + 3] = 0xff;
+                }
+            }
+
+            if (--pSynthesis->countBandsLeft == 0)
+                PushRGBATexture(std::move(pSynthesis->mPixels), n, n, pSynthesis->texture);
+        }
+};
+
+void TellSynthesizeSandTexture(Queue &queue, const WorldSeed seed, const GLuint texture)
+{
+    const size_t countBands = (SAND_TEXTURE_SIZE + SAND_TEXTURE_BAND_ROWS - 1) / SAND_TEXTURE_BAND_ROWS;
+    std::shared_ptr<SandSynthesis> pSynthesis = std::make_shared<SandSynthesis>(seed, countBands, texture);
+
+    size_t i;
+    for (i = 0; i < countBands; i++)
+        queue.Add(new SandBandSynthJob(pSynthesis, i * SAND_TEXTURE_BAND_ROWS,
+                                       std::min(size_t(SAND_TEXTURE_BAND_ROWS), SAND_TEXTURE_SIZE - i * SAND_TEXTURE_BAND_ROWS)));
+}
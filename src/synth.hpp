@@ -0,0 +1,24 @@
+#ifndef SYNTH_HPP
+#define SYNTH_HPP
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "load.hpp"
+#include "noise.hpp"
+
+
+// In texels, a power of two.
+#define SAND_TEXTURE_SIZE 1024
+
+// Rows per job.
+#define SAND_TEXTURE_BAND_ROWS 64
+
+/**
+ *  Fills the texture with sand, made from noise that tiles.
+ *  The bands of rows are made in parallel, by the queue's workers.
+ *  Whichever band finishes last makes the mip levels and pushes the upload.
+ */
+void TellSynthesizeSandTexture(Queue &, const WorldSeed, const GLuint texture);
+
+#endif  // SYNTH_HPP
@@ -1,6 +1,8 @@
 #include <memory>
+#include <algorithm>
 
 #include <glm/gtc/type_ptr.hpp>
+#include <cairo/cairo.h>
 
 #include "text.hpp"
 #include "app.hpp"
@@ -48,29 +50,109 @@ void main()
 }
 )shader";
 
+TextRenderer::TextRenderer(void)
+: bufferCapacity(0), pAtlas(NULL)
+{
+}
 void TextRenderer::TellInit(Queue &queue)
 {
     pBuffer = App::Instance().GetGLManager()->AllocBuffer();
-    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
-
-    glBindBuffer(GL_ARRAY_BUFFER, *pBuffer);
-    CHECK_GL();
-
-    glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(TextGL::GlyphVertex), NULL, GL_DYNAMIC_DRAW);
-    CHECK_GL();
+    mProgram.Alloc();
 
     VertexAttributeMap attributes;
     attributes["position"] = GLYPHVERTEX_POSITION_INDEX;
     attributes["texCoords"] = GLYPHVERTEX_TEXCOORDS_INDEX;
-    App::Instance().PushGL(new ShaderLoadJob(*pProgram, glyphVertexShaderSrc, glyphFragmentShaderSrc, attributes));
+    App::Instance().PushGL(new ShaderLoadJob(mProgram, glyphVertexShaderSrc, glyphFragmentShaderSrc, attributes));
 }
 void TextRenderer::SetProjection(const mat4 &m)
 {
     projection = m;
 }
-void TextRenderer::OnGlyph(const TextGL::UTF8Char, const TextGL::GlyphQuad &quad, const TextGL::TextSelectionDetails &)
+void TextRenderer::RenderText(const FontStyleChoice choice, const int8_t *text, const TextGL::TextParams &params)
+{
+    FontManager *pFontManager = App::Instance().GetFontManager();
+
+    mVertices.clear();
+    mGlyphTextures.clear();
+
+    pAtlas = pFontManager->GetAtlas(choice);
+    IterateText(pFontManager->GetFont(choice), text, params);
+
+    Flush();
+}
+void TextRenderer::OnGlyph(const TextGL::UTF8Char c, const TextGL::GlyphQuad &quad, const TextGL::TextSelectionDetails &)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, *pBuffer);
+    TextGL::GlyphVertex vertices[4];
+    GLuint texture = quad.texture;
+    size_t i;
+
+    for (i = 0; i < 4; i++)
+        vertices[i] = quad.vertices[i];
+
+    // Move the texture coords into the glyph's rectangle on the atlas.
+    if (pAtlas != NULL && pAtlas->mRects.find(c) != pAtlas->mRects.end())
+    {
+        const GlyphAtlasRect &rect = pAtlas->mRects.at(c);
+
+        for (i = 0; i < 4; i++)
+        {
+            vertices[i].tx = (rect.x + vertices[i].tx * rect.width) / pAtlas->width;
+            vertices[i].ty = (rect.y + vertices[i].ty * rect.height) / pAtlas->height;
+        }
+
+        texture = pAtlas->texture;
+    }
+
+    // Two triangles, so that quads don't need to be connected.
+    mVertices.push_back(vertices[0]);
+    mVertices.push_back(vertices[1]);
+    mVertices.push_back(vertices[3]);
+    mVertices.push_back(vertices[3]);
+    mVertices.push_back(vertices[1]);
+    mVertices.push_back(vertices[2]);
+
+    mGlyphTextures.push_back(texture);
+}
+void TextRenderer::Flush(void)
+{
+    GLState *pState = App::Instance().GetGLState();
+
+    size_t i, countGlyphs = mGlyphTextures.size();
+    if (countGlyphs <= 0)
+        return;
+
+    /*  Glyphs on a line don't overlap, so the drawing order doesn't matter.
+        Group them by texture, to need only one draw call per texture.
+     */
+    mGlyphOrder.resize(countGlyphs);
+    for (i = 0; i < countGlyphs; i++)
+        mGlyphOrder[i] = i;
+
+    std::stable_sort(mGlyphOrder.begin(), mGlyphOrder.end(),
+                     [this](const size_t a, const size_t b) { return mGlyphTextures[a] < mGlyphTextures[b]; });
+
+    mSortedVertices.clear();
+    mBatches.clear();
+    for (size_t glyph : mGlyphOrder)
+    {
+        mSortedVertices.insert(mSortedVertices.end(), mVertices.begin() + 6 * glyph, mVertices.begin() + 6 * (glyph + 1));
+
+        if (mBatches.size() > 0 && mBatches.back().texture == mGlyphTextures[glyph])
+            mBatches.back().count += 6;
+        else
+            mBatches.push_back({mGlyphTextures[glyph], GLint(mSortedVertices.size() - 6), 6});
+    }
+
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pBuffer);
+
+    // Orphan the old contents, grow if needed.
+    if (mSortedVertices.size() > bufferCapacity)
+        bufferCapacity = mSortedVertices.size();
+
+    glBufferData(GL_ARRAY_BUFFER, bufferCapacity * sizeof(TextGL::GlyphVertex), NULL, GL_STREAM_DRAW);
+    CHECK_GL();
+
+    glBufferSubData(GL_ARRAY_BUFFER, 0, mSortedVertices.size() * sizeof(TextGL::GlyphVertex), mSortedVertices.data());
     CHECK_GL();
 
     glEnableVertexAttribArray(GLYPHVERTEX_POSITION_INDEX);
@@ -82,36 +164,16 @@ void TextRenderer::OnGlyph(const TextGL::UTF8Char, const TextGL::GlyphQuad &quad
     glVertexAttribPointer(GLYPHVERTEX_TEXCOORDS_INDEX, 2, GL_FLOAT, GL_FALSE, sizeof(TextGL::GlyphVertex), (GLvoid *)(2 * sizeof(GLfloat)));
     CHECK_GL();
 
-    // Fill the buffer.
+    pState->Disable(GL_DEPTH_TEST);
 
-    TextGL::GlyphVertex *pVertexBuffer = (TextGL::GlyphVertex *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-    CHECK_GL();
-
-    pVertexBuffer[0] = quad.vertices[0];
-    pVertexBuffer[1] = quad.vertices[1];
-    pVertexBuffer[2] = quad.vertices[3];
-    pVertexBuffer[3] = quad.vertices[2];
-
-    glUnmapBuffer(GL_ARRAY_BUFFER);
-    CHECK_GL();
-
-    // Draw the buffer.
-
-    glDisable(GL_DEPTH_TEST);
-    CHECK_GL();
-
-    glEnable(GL_BLEND);
-    CHECK_GL();
+    pState->Enable(GL_BLEND);
 
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     CHECK_GL();
 
-    glUseProgram(*pProgram);
-    CHECK_GL();
+    mProgram.Use();
 
-    GLint location = glGetUniformLocation(*pProgram, "projectionMatrix");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(location);
+    GLint location = mProgram.GetUniformLocation("projectionMatrix");
 
     glUniformMatrix4fv(location, 1, GL_FALSE, value_ptr(projection));
     CHECK_GL();
@@ -119,11 +181,14 @@ void TextRenderer::OnGlyph(const TextGL::UTF8Char, const TextGL::GlyphQuad &quad
     glActiveTexture(GL_TEXTURE0);
     CHECK_GL();
 
-    glBindTexture(GL_TEXTURE_2D, quad.texture);
-    CHECK_GL();
+    for (const GlyphBatch &batch : mBatches)
+    {
+        glBindTexture(GL_TEXTURE_2D, batch.texture);
+        CHECK_GL();
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    CHECK_GL();
+        glDrawArrays(GL_TRIANGLES, batch.first, batch.count);
+        CHECK_GL();
+    }
 
     glDisableVertexAttribArray(GLYPHVERTEX_POSITION_INDEX);
     CHECK_GL();
@@ -131,39 +196,354 @@ void TextRenderer::OnGlyph(const TextGL::UTF8Char, const TextGL::GlyphQuad &quad
     CHECK_GL();
 }
 
-TextGL::GLTextureFont *FontManager::InitFont(const FontStyleChoice choice, const TextGL::FontStyle &style)
+/**
+ *  Places rectangles from left to right, each as low as possible on top of the ones below.
+ *  The skyline is a list of horizontal segments, that together span the full width.
+ */
+class SkylinePacker
+{
+    private:
+        struct Segment
+        {
+            GLint x, y;
+            GLsizei width;
+        };
+
+        GLsizei width, height;
+        std::vector<Segment> mSegments;
+
+        // Returns -1 if it doesn't fit at segment i.
+        GLint FitAt(const size_t i, const GLsizei w, const GLsizei h) const
+        {
+            GLint x = mSegments[i].x, y = 0;
+            GLsizei remaining = w;
+            size_t j;
+
+            if ((x + w) > width)
+                return -1;
+
+            for (j = i; remaining > 0; j++)
+            {
+                y = std::max(y, mSegments[j].y);
+                if ((y + h) > height)
+                    return -1;
+
+                remaining -= mSegments[j].width;
+            }
+
+            return y;
+        }
+    public:
+        SkylinePacker(const GLsizei w, const GLsizei h)
+        : width(w), height(h)
+        {
+            mSegments.push_back({0, 0, w});
+        }
+
+        bool Insert(const GLsizei w, const GLsizei h, GLint &x, GLint &y)
+        {
+            size_t i, best = 0;
+            GLint bestY = -1, fitY;
+
+            for (i = 0; i < mSegments.size(); i++)
+            {
+                fitY = FitAt(i, w, h);
+                if (fitY >= 0 && (bestY < 0 || fitY < bestY))
+                {
+                    bestY = fitY;
+                    best = i;
+                }
+            }
+
+            if (bestY < 0)
+                return false;
+
+            x = mSegments[best].x;
+            y = bestY;
+
+            // Cut the segments that end up below the new rectangle.
+            Segment top = {x, y + h, w};
+            GLint end = x + w;
+            i = best;
+            while (i < mSegments.size() && mSegments[i].x < end)
+            {
+                GLint segmentEnd = mSegments[i].x + mSegments[i].width;
+                if (segmentEnd <= end)
+                    mSegments.erase(mSegments.begin() + i);
+                else
+                {
+                    mSegments[i].width = segmentEnd - end;
+                    mSegments[i].x = end;
+                    break;
+                }
+            }
+            mSegments.insert(mSegments.begin() + best, top);
+
+            return true;
+        }
+};
+
+// Leaves room for linear filtering.
+#define GLYPH_ATLAS_PADDING 1
+
+// OpenGL 3.2 guarantees at least this texture size.
+#define GLYPH_ATLAS_MAX_SIZE 1024
+
+struct GlyphImage
+{
+    TextGL::UTF8Char c;
+    cairo_surface_t *pSurface;
+    GLsizei width, height;
+};
+
+/**
+ *  Packs the glyph bitmaps that text-gl drew into one RGBA image.
+ *  This needs no GL calls.
+ */
+void PackGlyphAtlas(const TextGL::ImageFont *pImageFont, GlyphAtlas &atlas, std::vector<GLubyte> &pixels)
 {
-    if (mFonts.find(choice) == mFonts.end())
+    std::vector<GlyphImage> images;
+    for (const auto &pair : pImageFont->glyphs)
     {
-        std::unique_ptr<TextGL::ImageFont, void (*)(TextGL::ImageFont *)> pImageFont(TextGL::MakeImageFont(mFontData, style), TextGL::DestroyImageFont);
+        cairo_surface_t *pSurface = pair.second.surface;
+        if (pSurface == NULL)
+            continue;  // nothing to draw, like a space
+
+        cairo_surface_flush(pSurface);
+
+        GlyphImage image;
+        image.c = pair.first;
+        image.pSurface = pSurface;
+        image.width = cairo_image_surface_get_width(pSurface);
+        image.height = cairo_image_surface_get_height(pSurface);
+        if (image.width > 0 && image.height > 0)
+            images.push_back(image);
+    }
+
+    // The tallest first, so that shelves fill up evenly.
+    std::sort(images.begin(), images.end(),
+              [](const GlyphImage &a, const GlyphImage &b) { return a.height > b.height; });
 
-        mFonts.emplace(choice, TextGL::MakeGLTextureFont(pImageFont.get()));
+    atlas.width = 64;
+    atlas.height = 64;
+    while (true)
+    {
+        SkylinePacker packer(atlas.width, atlas.height);
+        bool fits = true;
+        atlas.mRects.clear();
+
+        for (const GlyphImage &image : images)
+        {
+            GlyphAtlasRect rect;
+            rect.width = image.width;
+            rect.height = image.height;
+            if (!packer.Insert(image.width + GLYPH_ATLAS_PADDING, image.height + GLYPH_ATLAS_PADDING, rect.x, rect.y))
+            {
+                fits = false;
+                break;
+            }
+
+            atlas.mRects[image.c] = rect;
+        }
+
+        if (fits)
+            break;
+
+        // Grow, keeping the atlas close to square.
+        if (atlas.width <= atlas.height)
+            atlas.width *= 2;
+        else
+            atlas.height *= 2;
+
+        if (atlas.width > GLYPH_ATLAS_MAX_SIZE || atlas.height > GLYPH_ATLAS_MAX_SIZE)
+            throw FormatError("Glyphs don't fit in a %d x %d atlas", GLYPH_ATLAS_MAX_SIZE, GLYPH_ATLAS_MAX_SIZE);
     }
 
-    return mFonts.at(choice);
+    // Transparent, also in the padding.
+    pixels.assign(4 * atlas.width * atlas.height, 0);
+
+    for (const GlyphImage &image : images)
+    {
+        const GlyphAtlasRect &rect = atlas.mRects.at(image.c);
+        const unsigned char *pData = cairo_image_surface_get_data(image.pSurface);
+        int stride = cairo_image_surface_get_stride(image.pSurface);
+        GLsizei x, y;
+
+        for (y = 0; y < rect.height; y++)
+        {
+            const uint32_t *pRow = (const uint32_t *)(pData + y * stride);
+            GLubyte *pOut = pixels.data() + 4 * ((rect.y + y) * atlas.width + rect.x);
+
+            for (x = 0; x < rect.width; x++)
+            {
+                // Cairo stores premultiplied ARGB, in native byte order.
+                uint32_t argb = pRow[x];
+                GLubyte a = argb >> 24,
+                        r = (argb >> 16) & 0xff,
+                        g = (argb >> 8) & 0xff,
+                        b = argb & 0xff;
+
+                if (a > 0)
+                {
+                    r = (r * 255) / a;
+                    g = (g * 255) / a;
+                    b = (b * 255) / a;
+                }
+
+                pOut[4 * x] = r;
+                pOut[4 * x + 1] = g;
+                pOut[4 * x + 2] = b;
+                pOut[4 * x + 3] = a;
+            }
+        }
+    }
+}
+
+/**
+ *  Uploads the packed atlas and makes a font for text-gl's layout,
+ *  that points every glyph at the atlas instead of at a texture of its own.
+ */
+TextGL::GLTextureFont *MakeAtlasFont(const TextGL::ImageFont *pImageFont, GlyphAtlas &atlas, const std::vector<GLubyte> &pixels)
+{
+    glGenTextures(1, &atlas.texture);
+    CHECK_GL();
+
+    glBindTexture(GL_TEXTURE_2D, atlas.texture);
+    CHECK_GL();
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    CHECK_GL();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    CHECK_GL();
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas.width, atlas.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    CHECK_GL();
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL();
+
+    TextGL::GLTextureFont *pFont = new TextGL::GLTextureFont;
+    pFont->style = pImageFont->style;
+    pFont->metrics = pImageFont->metrics;
+    pFont->horizontalKernTable = pImageFont->horizontalKernTable;
+
+    for (const auto &pair : pImageFont->glyphs)
+    {
+        TextGL::GLTextureGlyph &glyph = pFont->glyphs[pair.first];
+        glyph.metrics = pair.second.metrics;
+
+        // Texture coords come out over the glyph's own rectangle, the renderer moves them onto the atlas.
+        if (atlas.mRects.find(pair.first) != atlas.mRects.end())
+        {
+            const GlyphAtlasRect &rect = atlas.mRects.at(pair.first);
+            glyph.texture = atlas.texture;
+            glyph.textureWidth = rect.width;
+            glyph.textureHeight = rect.height;
+        }
+        else
+        {
+            glyph.texture = 0;
+            glyph.textureWidth = 0;
+            glyph.textureHeight = 0;
+        }
+    }
+
+    return pFont;
 }
+
 const TextGL::GLTextureFont *FontManager::GetFont(const FontStyleChoice choice)
 {
     return mFonts.at(choice);
 }
-void FontManager::InitAll(const boost::filesystem::path &path)
+const GlyphAtlas *FontManager::GetAtlas(const FontStyleChoice choice)
 {
-    boost::filesystem::ifstream is;
-    is.open(path);
-
-    if (!is.good())
-        throw IOError("Cannot read %s", path.string().c_str());
+    return &mAtlases.at(choice);
+}
+void FontManager::AddFont(const FontStyleChoice choice, const TextGL::ImageFont *pImageFont,
+                          const GlyphAtlas &atlas, const std::vector<GLubyte> &pixels)
+{
+    if (mFonts.find(choice) != mFonts.end())
+        return;
 
-    TextGL::ParseSVGFontData(is, mFontData);
+    GlyphAtlas &added = mAtlases[choice];
+    added = atlas;
 
-    TextGL::FontStyle style;
-    style.size = 16.0;
-    style.strokeWidth = 0.0;
-    style.fillColor = {0.0, 0.0, 0.0, 1.0};
-    InitFont(FONT_SMALLBLACK, style);
+    mFonts.emplace(choice, MakeAtlasFont(pImageFont, added, pixels));
+}
+class FontUploadJob: public Job
+{
+    private:
+        FontStyleChoice choice;
+        std::unique_ptr<TextGL::ImageFont, void (*)(TextGL::ImageFont *)> pImageFont;
+        GlyphAtlas atlas;
+        std::vector<GLubyte> pixels;
+    public:
+        FontUploadJob(const FontStyleChoice c, TextGL::ImageFont *p, const GlyphAtlas &a, std::vector<GLubyte> &&px)
+        : choice(c), pImageFont(p, TextGL::DestroyImageFont), atlas(a), pixels(std::move(px))
+        {
+        }
+
+        void Run(void)
+        {
+            App::Instance().GetFontManager()->AddFont(choice, pImageFont.get(), atlas, pixels);
+        }
+
+        size_t GetUploadSize(void) const
+        {
+            return pixels.size();
+        }
+};
+// Decompresses and parses the font, then draws and packs the glyphs, so that only the upload is left for the GL thread.
+class FontLoadJob: public Job
+{
+    private:
+        std::string location;
+    public:
+        FontLoadJob(const std::string &loc): location(loc) {}
+
+        void Run(void)
+        {
+            TextGL::FontData fontData;
+            {
+                std::shared_ptr<const Resource> pResource = App::Instance().OpenResource(location);
+                SpanStream is(*pResource);
+
+                TextGL::ParseSVGFontData(is, fontData);
+            }
+
+            TextGL::FontStyle style;
+            style.size = 16.0;
+            style.strokeWidth = 0.0;
+            style.fillColor = {0.0, 0.0, 0.0, 1.0};
+
+            std::unique_ptr<TextGL::ImageFont, void (*)(TextGL::ImageFont *)> pImageFont(TextGL::MakeImageFont(fontData, style), TextGL::DestroyImageFont);
+
+            GlyphAtlas atlas;
+            std::vector<GLubyte> pixels;
+            PackGlyphAtlas(pImageFont.get(), atlas, pixels);
+
+            App::Instance().PushGL(new FontUploadJob(FONT_SMALLBLACK, pImageFont.release(), atlas, std::move(pixels)));
+        }
+};
+void FontManager::TellInit(Queue &queue, const std::string &location)
+{
+    queue.Add(new FontLoadJob(location));
 }
 void FontManager::DestroyAll(void)
 {
+    for (auto &pair : mAtlases)
+    {
+        glDeleteTextures(1, &pair.second.texture);
+        CHECK_GL();
+    }
+    mAtlases.clear();
+
+    // Their glyphs only refer to the atlases, so text-gl has no textures to delete.
     for (auto &pair : mFonts)
-        TextGL::DestroyGLTextureFont(pair.second);
+        delete pair.second;
+    mFonts.clear();
 }
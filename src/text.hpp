@@ -2,6 +2,7 @@
 #define TEXT_HPP
 
 #include <unordered_map>
+#include <vector>
 
 #include <glm/glm.hpp>
 using namespace glm;
@@ -12,38 +13,90 @@ using namespace glm;
 #include "load.hpp"
 
 
+enum FontStyleChoice
+{
+    FONT_SMALLBLACK
+};
+
+// Where a glyph's bitmap was put, in texels.
+struct GlyphAtlasRect
+{
+    GLint x, y;
+    GLsizei width, height;
+};
+
+// All glyphs of one font, in one texture.
+struct GlyphAtlas
+{
+    GLuint texture;
+    GLsizei width, height;
+
+    // by character
+    std::unordered_map<TextGL::UTF8Char, GlyphAtlasRect> mRects;
+};
+
+// Glyphs that share a texture.
+struct GlyphBatch
+{
+    GLuint texture;
+    GLint first;
+    GLsizei count;
+};
+
+/**
+ *  Collects the glyph quads of a text in one vertex buffer,
+ *  then draws them with one call per texture.
+ */
 class TextRenderer: public TextGL::GLTextLeftToRightIterator, Initializable
 {
     private:
-        GLRef pBuffer,
-              pProgram;
+        GLRef pBuffer;
+        ShaderProgram mProgram;
 
         mat4 projection;
 
+        // Six vertices and one texture per glyph, in text order.
+        std::vector<TextGL::GlyphVertex> mVertices;
+        std::vector<GLuint> mGlyphTextures;
+
+        // Reordered by texture, for uploading.
+        std::vector<size_t> mGlyphOrder;
+        std::vector<TextGL::GlyphVertex> mSortedVertices;
+        std::vector<GlyphBatch> mBatches;
+        size_t bufferCapacity;  // in vertices
+
+        const GlyphAtlas *pAtlas;
+
         void OnGlyph(const TextGL::UTF8Char, const TextGL::GlyphQuad &, const TextGL::TextSelectionDetails &);
+        void Flush(void);
     public:
+        TextRenderer(void);
+
         void SetProjection(const mat4 &);
 
-        void TellInit(Queue &);
-};
+        // Use this instead of IterateText.
+        void RenderText(const FontStyleChoice, const int8_t *text, const TextGL::TextParams &);
 
-enum FontStyleChoice
-{
-    FONT_SMALLBLACK
+        void TellInit(Queue &);
 };
 
 class FontManager
 {
     private:
-        TextGL::FontData mFontData;
-
         std::unordered_map<FontStyleChoice, TextGL::GLTextureFont *> mFonts;
-
-        TextGL::GLTextureFont *InitFont(const FontStyleChoice, const TextGL::FontStyle &style);
+        std::unordered_map<FontStyleChoice, GlyphAtlas> mAtlases;
     public:
         const TextGL::GLTextureFont *GetFont(const FontStyleChoice);
+        const GlyphAtlas *GetAtlas(const FontStyleChoice);
+
+        // GL thread only. Uploads an atlas that was packed on a loading thread.
+        void AddFont(const FontStyleChoice, const TextGL::ImageFont *, const GlyphAtlas &, const std::vector<GLubyte> &pixels);
 
-        void InitAll(const boost::filesystem::path &);
+        /**
+         *  Queues the parsing and drawing of the svg font, at location in the resources.
+         *  The fonts can be used after the GL jobs that this pushes have run.
+         */
+        void TellInit(Queue &, const std::string &location);
         void DestroyAll(void);
 };
 
@@ -1,11 +1,19 @@
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 #include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 
 #include "texture.hpp"
 #include "error.hpp"
 #include "app.hpp"
+#include "s3tc.hpp"
 
 PNGError::PNGError(const char *format, ...)
 {
@@ -22,13 +30,14 @@ void PNGErrorCallback(png_structp pPNG, png_const_charp message)
 
 void PNGReadCallback(png_structp pPNG, png_bytep outData, png_size_t length)
 {
-    std::istream *pIs = (std::istream *)png_get_io_ptr(pPNG);
+    PNGReadCursor *pCursor = (PNGReadCursor *)png_get_io_ptr(pPNG);
 
-    pIs->read((char *)outData, length);
-    std::streamsize n = pIs->gcount();
+    if (pCursor->remaining < length)
+        throw PNGError("only %u bytes left, %u requested", (unsigned int)pCursor->remaining, (unsigned int)length);
 
-    if (n < length)
-        throw PNGError("only %u bytes read, %u requested", n, length);
+    memcpy(outData, pCursor->pData, length);
+    pCursor->pData += length;
+    pCursor->remaining -= length;
 }
 PNGReader::PNGReader(void)
 {
@@ -50,10 +59,12 @@ PNGReader::~PNGReader(void)
 {
     png_destroy_read_struct(&pPNG, &pInfo, &pEnd);
 }
-PNGImage *PNGReader::ReadImage(std::istream &is)
+PNGImage *PNGReader::ReadImage(const Resource &resource)
 {
+    PNGReadCursor cursor = {resource.GetData(), resource.GetSize()};
+
     // Tell libpng that it must take its data from a callback function.
-    png_set_read_fn(pPNG, &is, PNGReadCallback);
+    png_set_read_fn(pPNG, &cursor, PNGReadCallback);
 
     // Read info from the header.
     png_read_info(pPNG, pInfo);
@@ -114,6 +125,76 @@ void PNGReader::FreeImage(PNGImage *pImage)
     png_free(pPNG, pImage->data);
     delete pImage;
 };
+PNGRowReader::PNGRowReader(std::shared_ptr<const Resource> p)
+: pResource(p), pPNG(NULL), pInfo(NULL), pEnd(NULL)
+{
+    cursor.pData = pResource->GetData();
+    cursor.remaining = pResource->GetSize();
+
+    pPNG = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp)NULL,
+                                  (png_error_ptr)PNGErrorCallback,
+                                  (png_error_ptr)NULL);
+    if (pPNG == NULL)
+        throw PNGError("error creating png struct");
+
+    pInfo = png_create_info_struct(pPNG);
+    pEnd = png_create_info_struct(pPNG);
+    if (pInfo == NULL || pEnd == NULL)
+    {
+        png_destroy_read_struct(&pPNG, &pInfo, &pEnd);
+        throw PNGError("error creating info struct");
+    }
+
+    try
+    {
+        png_set_read_fn(pPNG, &cursor, PNGReadCallback);
+        png_read_info(pPNG, pInfo);
+
+        int bitDepth, interlaceType;
+        png_get_IHDR(pPNG, pInfo, &width, &height,
+                     &bitDepth, &colorType, &interlaceType, NULL, NULL);
+        if (bitDepth != 8)
+            throw FormatError("PNG image bit depth is %d", bitDepth);
+        else if (colorType != PNG_COLOR_TYPE_RGB && colorType != PNG_COLOR_TYPE_RGB_ALPHA)
+            throw FormatError("PNG image color type is 0x%x", colorType);
+
+        interlaced = interlaceType != PNG_INTERLACE_NONE;
+    }
+    catch (...)
+    {
+        png_destroy_read_struct(&pPNG, &pInfo, &pEnd);
+        throw;
+    }
+}
+PNGRowReader::~PNGRowReader(void)
+{
+    png_destroy_read_struct(&pPNG, &pInfo, &pEnd);
+}
+void PNGRowReader::GetDimensions(png_uint_32 &w, png_uint_32 &h) const
+{
+    w = width;
+    h = height;
+}
+int PNGRowReader::GetColorType(void) const
+{
+    return colorType;
+}
+size_t PNGRowReader::GetRowBytes(void) const
+{
+    return png_get_rowbytes(pPNG, pInfo);
+}
+bool PNGRowReader::IsInterlaced(void) const
+{
+    return interlaced;
+}
+void PNGRowReader::ReadRow(png_bytep row)
+{
+    png_read_row(pPNG, row, NULL);
+}
+void PNGRowReader::End(void)
+{
+    png_read_end(pPNG, pEnd);
+}
 int PNGImage::GetColorType(void) const
 {
     return colorType;
@@ -145,6 +226,14 @@ class FillGLTextureJob: public Job
         {
         }
 
+        size_t GetUploadSize(void) const
+        {
+            png_uint_32 w, h;
+            pImage->GetDimensions(w, h);
+
+            return size_t(w) * h * (pImage->GetColorType() == PNG_COLOR_TYPE_RGB ? 3 : 4);
+        }
+
         void Run(void)
         {
             png_uint_32 w, h;
@@ -153,7 +242,7 @@ class FillGLTextureJob: public Job
             glBindTexture(GL_TEXTURE_2D, tex);
             CHECK_GL();
 
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
             CHECK_GL();
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             CHECK_GL();
@@ -173,23 +262,746 @@ class FillGLTextureJob: public Job
             CHECK_GL();
         }
 };
+GLenum CompressedImage::GetInternalFormat(void) const
+{
+    return internalFormat;
+}
+size_t CompressedImage::CountLevels(void) const
+{
+    return mLevels.size();
+}
+const CompressedMipLevel &CompressedImage::GetLevel(const size_t i) const
+{
+    return mLevels.at(i);
+}
+size_t CompressedImage::GetSize(void) const
+{
+    size_t size = 0;
+    for (const CompressedMipLevel &level : mLevels)
+        size += level.size;
+
+    return size;
+}
+size_t GetS3TCBlockSize(const GLenum internalFormat)
+{
+    return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? S3TC_DXT1_BLOCK_SIZE : S3TC_DXT5_BLOCK_SIZE;
+}
+// Averages 2 x 2 pixels, an odd last row or column is sampled twice.
+void HalveRGBA(const std::vector<uint8_t> &src, const size_t width, const size_t height,
+               std::vector<uint8_t> &dst, const size_t halfWidth, const size_t halfHeight)
+{
+    size_t x, y, x0, x1, y0, y1, c;
+
+    dst.resize(4 * halfWidth * halfHeight);
+    for (y = 0; y < halfHeight; y++)
+    {
+        y0 = std::min(2 * y, height - 1);
+        y1 = std::min(2 * y + 1, height - 1);
+        for (x = 0; x < halfWidth; x++)
+        {
+            x0 = std::min(2 * x, width - 1);
+            x1 = std::min(2 * x + 1, width - 1);
+            for (c = 0; c < 4; c++)
+                dst[4 * (y * halfWidth + x) + c] = (src[4 * (y0 * width + x0) + c] + src[4 * (y0 * width + x1) + c] +
+                                                    src[4 * (y1 * width + x0) + c] + src[4 * (y1 * width + x1) + c] + 2) / 4;
+        }
+    }
+}
+CompressedImage *CompressImage(const PNGImage *pImage)
+{
+    png_uint_32 w, h;
+    pImage->GetDimensions(w, h);
+
+    size_t width = w, height = h, i;
+    bool alpha = pImage->GetColorType() == PNG_COLOR_TYPE_RGBA;
+
+    std::vector<uint8_t> rgba(4 * width * height);
+    const uint8_t *pData = (const uint8_t *)pImage->GetData();
+    if (alpha)
+        std::copy(pData, pData + rgba.size(), rgba.begin());
+    else
+    {
+        for (i = 0; i < width * height; i++)
+        {
+            std::copy(pData + 3 * i, pData + 3 * (i + 1), rgba.begin() + 4 * i);
+            rgba[4 * i + 3] = 0xff;
+        }
+    }
+
+    return CompressRGBA(std::move(rgba), width, height, alpha);
+}
+// Lays out all levels in the image's own buffer, for the compressor to fill.
+CompressedImage *AllocCompressedImage(size_t width, size_t height, const bool alpha)
+{
+    std::unique_ptr<CompressedImage> pCompressed(new CompressedImage);
+    pCompressed->internalFormat = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    size_t blockSize = GetS3TCBlockSize(pCompressed->internalFormat),
+           offset = 0;
+
+    // Lay out the levels first, the buffer mustn't move afterwards.
+    while (true)
+    {
+        CompressedMipLevel level;
+        level.width = width;
+        level.height = height;
+        level.size = CountS3TCBytes(width, height, blockSize);
+        pCompressed->mLevels.push_back(level);
+
+        offset += level.size;
+
+        if (width <= 1 && height <= 1)
+            break;
+
+        width = std::max(width / 2, size_t(1));
+        height = std::max(height / 2, size_t(1));
+    }
+    pCompressed->mBuffer.resize(offset);
+
+    offset = 0;
+    for (CompressedMipLevel &level : pCompressed->mLevels)
+    {
+        level.pData = pCompressed->mBuffer.data() + offset;
+        offset += level.size;
+    }
+
+    return pCompressed.release();
+}
+// Compresses the levels from firstLevel on, the rgba pixels are those of firstLevel.
+void CompressMipLevels(CompressedImage *pCompressed, std::vector<uint8_t> &&rgba, const size_t firstLevel)
+{
+    std::vector<uint8_t> half;
+    size_t i;
+
+    for (i = firstLevel; i < pCompressed->mLevels.size(); i++)
+    {
+        const CompressedMipLevel &level = pCompressed->mLevels[i];
+        uint8_t *pOut = pCompressed->mBuffer.data() + (level.pData - pCompressed->mBuffer.data());
+
+        if (pCompressed->internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            CompressImageDXT5(rgba.data(), level.width, level.height, pOut);
+        else
+            CompressImageDXT1(rgba.data(), level.width, level.height, pOut);
+
+        if ((i + 1) < pCompressed->mLevels.size())
+        {
+            const CompressedMipLevel &next = pCompressed->mLevels[i + 1];
+            HalveRGBA(rgba, level.width, level.height, half, next.width, next.height);
+            std::swap(rgba, half);
+        }
+    }
+}
+CompressedImage *CompressRGBA(std::vector<uint8_t> &&rgba, size_t width, size_t height, const bool alpha)
+{
+    std::unique_ptr<CompressedImage> pCompressed(AllocCompressedImage(width, height, alpha));
+
+    CompressMipLevels(pCompressed.get(), std::move(rgba), 0);
+
+    return pCompressed.release();
+}
+/**
+ *  Compresses the first level a row of blocks at a time, as the rows are decoded.
+ *  Meanwhile, the rows are summed into the second level, from which the smaller ones are made at the end.
+ *  The result is the same as CompressImage's. Returns NULL if the png can't be read row by row.
+ */
+CompressedImage *StreamCompressPNG(std::shared_ptr<const Resource> pResource)
+{
+    PNGRowReader reader(pResource);
+    if (reader.IsInterlaced())
+        return NULL;
+
+    png_uint_32 w, h;
+    reader.GetDimensions(w, h);
+
+    const size_t width = w, height = h,
+                 halfWidth = std::max(width / 2, size_t(1)),
+                 halfHeight = std::max(height / 2, size_t(1));
+    const bool alpha = reader.GetColorType() == PNG_COLOR_TYPE_RGBA;
+
+    std::unique_ptr<CompressedImage> pCompressed(AllocCompressedImage(width, height, alpha));
+    uint8_t *pOut = pCompressed->mBuffer.data();  // the first level comes first
+    const size_t blockRowSize = CountS3TCBytes(width, S3TC_BLOCK_WIDTH, GetS3TCBlockSize(pCompressed->internalFormat));
+
+    std::vector<png_byte> row(reader.GetRowBytes());
+    std::vector<uint8_t> band(4 * width * S3TC_BLOCK_WIDTH);
+    std::vector<uint16_t> sums(4 * halfWidth * halfHeight, 0);  // of the 2 x 2 pixels, as HalveRGBA takes them
+
+    size_t y = height, countRows, r, i, x, c, halfY, x0, x1, count;
+    while (y > 0)
+    {
+        /*
+         *  The png's first row is at the top, the GL's first row at the bottom.
+         *  Block rows start at the bottom, so the first band is the top one, that may be shorter.
+         */
+        countRows = (y - 1) % S3TC_BLOCK_WIDTH + 1;
+        y -= countRows;
+
+        for (i = countRows; i > 0; i--)
+        {
+            reader.ReadRow(row.data());
+
+            r = y + i - 1;
+            uint8_t *pPixels = band.data() + 4 * width * (i - 1);
+            if (alpha)
+                std::copy(row.begin(), row.end(), pPixels);
+            else
+            {
+                for (x = 0; x < width; x++)
+                {
+                    std::copy(row.begin() + 3 * x, row.begin() + 3 * (x + 1), pPixels + 4 * x);
+                    pPixels[4 * x + 3] = 0xff;
+                }
+            }
+
+            // A row past the top is sampled as the last row, like HalveRGBA does.
+            halfY = r / 2;
+            if (halfY >= halfHeight)
+                continue;
+
+            count = (std::min(2 * halfY, height - 1) == r) + (std::min(2 * halfY + 1, height - 1) == r);
+            for (x = 0; x < halfWidth; x++)
+            {
+                x0 = std::min(2 * x, width - 1);
+                x1 = std::min(2 * x + 1, width - 1);
+                for (c = 0; c < 4; c++)
+                    sums[4 * (halfY * halfWidth + x) + c] += count * (pPixels[4 * x0 + c] + pPixels[4 * x1 + c]);
+            }
+        }
+
+        if (alpha)
+            CompressImageDXT5(band.data(), width, countRows, pOut + (y / S3TC_BLOCK_WIDTH) * blockRowSize);
+        else
+            CompressImageDXT1(band.data(), width, countRows, pOut + (y / S3TC_BLOCK_WIDTH) * blockRowSize);
+    }
+    reader.End();
+
+    if (pCompressed->CountLevels() > 1)
+    {
+        std::vector<uint8_t> half(sums.size());
+        for (i = 0; i < sums.size(); i++)
+            half[i] = (sums[i] + 2) / 4;
+
+        CompressMipLevels(pCompressed.get(), std::move(half), 1);
+    }
+
+    return pCompressed.release();
+}
+
+const uint8_t ktxIdentifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+#define KTX_ENDIANNESS 0x04030201
+
+struct KTXHeader
+{
+    uint32_t endianness,
+             glType,
+             glTypeSize,
+             glFormat,
+             glInternalFormat,
+             glBaseInternalFormat,
+             pixelWidth,
+             pixelHeight,
+             pixelDepth,
+             numberOfArrayElements,
+             numberOfFaces,
+             numberOfMipmapLevels,
+             bytesOfKeyValueData;
+};
+
+// Points into the data, so that nothing needs to be copied.
+struct KTXCursor
+{
+    const char *pData;
+    size_t remaining;
+
+    const char *Take(const size_t n)
+    {
+        if (remaining < n)
+            throw IOError("only %u bytes left, %u requested", (unsigned int)remaining, (unsigned int)n);
+
+        const char *p = pData;
+        pData += n;
+        remaining -= n;
+
+        return p;
+    }
+};
+
+CompressedImage *ReadKTX(std::shared_ptr<const Resource> pResource)
+{
+    KTXCursor cursor = {pResource->GetData(), pResource->GetSize()};
+
+    if (memcmp(cursor.Take(sizeof(ktxIdentifier)), ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+        throw FormatError("not a KTX 1.1 file");
+
+    KTXHeader header;
+    memcpy(&header, cursor.Take(sizeof(header)), sizeof(header));
+    if (header.endianness != KTX_ENDIANNESS)
+        throw FormatError("KTX endianness is 0x%x", header.endianness);
+    else if (header.glInternalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT &&
+             header.glInternalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        throw FormatError("KTX internal format is 0x%x", header.glInternalFormat);
+    else if (header.pixelDepth != 0 || header.numberOfArrayElements != 0 || header.numberOfFaces != 1)
+        throw FormatError("KTX file is not a 2D texture");
+    else if (header.pixelWidth <= 0 || header.pixelHeight <= 0 || header.numberOfMipmapLevels <= 0)
+        throw FormatError("KTX file is empty");
+
+    // A full mip chain ends at 1x1, after floor(log2(max(width, height))) + 1 levels.
+    uint32_t maxLevels = 0, largest = std::max(header.pixelWidth, header.pixelHeight);
+    for (; largest > 0; largest >>= 1)
+        maxLevels++;
+
+    if (header.numberOfMipmapLevels > maxLevels)
+        throw FormatError("KTX file has %u mip levels for a %ux%u texture",
+                          header.numberOfMipmapLevels, header.pixelWidth, header.pixelHeight);
+
+    cursor.Take(header.bytesOfKeyValueData);
+
+    std::unique_ptr<CompressedImage> pCompressed(new CompressedImage);
+    pCompressed->internalFormat = header.glInternalFormat;
+    pCompressed->pResource = pResource;
+    size_t blockSize = GetS3TCBlockSize(header.glInternalFormat);
+
+    uint32_t i, imageSize;
+    for (i = 0; i < header.numberOfMipmapLevels; i++)
+    {
+        CompressedMipLevel level;
+        level.width = std::max(header.pixelWidth >> i, uint32_t(1));
+        level.height = std::max(header.pixelHeight >> i, uint32_t(1));
+
+        memcpy(&imageSize, cursor.Take(sizeof(imageSize)), sizeof(imageSize));
+        if (imageSize != CountS3TCBytes(level.width, level.height, blockSize))
+            throw FormatError("KTX mip level %u has size %u", i, imageSize);
+
+        // Block sizes are multiples of four, so there's no padding.
+        level.size = imageSize;
+        level.pData = (const uint8_t *)cursor.Take(imageSize);
+
+        pCompressed->mLevels.push_back(level);
+    }
+
+    return pCompressed.release();
+}
+void WriteKTX(std::ostream &os, const CompressedImage *pImage)
+{
+    KTXHeader header;
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = 0;
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+    header.glInternalFormat = pImage->GetInternalFormat();
+    header.glBaseInternalFormat = pImage->GetInternalFormat() == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA;
+    header.pixelWidth = pImage->GetLevel(0).width;
+    header.pixelHeight = pImage->GetLevel(0).height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = pImage->CountLevels();
+    header.bytesOfKeyValueData = 0;
+
+    os.write((const char *)ktxIdentifier, sizeof(ktxIdentifier));
+    os.write((const char *)&header, sizeof(header));
+
+    size_t i;
+    uint32_t imageSize;
+    for (i = 0; i < pImage->CountLevels(); i++)
+    {
+        const CompressedMipLevel &level = pImage->GetLevel(i);
+
+        imageSize = level.size;
+        os.write((const char *)&imageSize, sizeof(imageSize));
+        os.write((const char *)level.pData, imageSize);
+    }
+
+    if (!os.good())
+        throw IOError("error writing KTX data");
+}
+class FillCompressedGLTextureJob: public Job
+{
+    private:
+        std::shared_ptr<const CompressedImage> pImage;
+        GLuint tex;
+    public:
+        FillCompressedGLTextureJob(std::shared_ptr<const CompressedImage> p, const GLuint texture)
+        :pImage(p), tex(texture)
+        {
+        }
+
+        size_t GetUploadSize(void) const
+        {
+            return pImage->GetSize();
+        }
+
+        void Run(void)
+        {
+            size_t i;
+
+            glBindTexture(GL_TEXTURE_2D, tex);
+            CHECK_GL();
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            CHECK_GL();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            CHECK_GL();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pImage->CountLevels() - 1);
+            CHECK_GL();
+
+            for (i = 0; i < pImage->CountLevels(); i++)
+            {
+                const CompressedMipLevel &level = pImage->GetLevel(i);
+
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, pImage->GetInternalFormat(),
+                                       level.width, level.height, 0,
+                                       level.size, level.pData);
+                CHECK_GL();
+            }
+        }
+};
+// Uncompressed, all levels made in advance.
+class FillGLMipChainJob: public Job
+{
+    private:
+        std::vector<std::vector<uint8_t>> mLevels;  // RGBA
+        GLsizei width, height;
+        GLuint tex;
+    public:
+        FillGLMipChainJob(std::vector<std::vector<uint8_t>> &&levels, const GLsizei w, const GLsizei h, const GLuint texture)
+        : mLevels(std::move(levels)), width(w), height(h), tex(texture)
+        {
+        }
+
+        size_t GetUploadSize(void) const
+        {
+            size_t size = 0;
+            for (const std::vector<uint8_t> &level : mLevels)
+                size += level.size();
+
+            return size;
+        }
+
+        void Run(void)
+        {
+            GLsizei w = width, h = height;
+            size_t i;
+
+            glBindTexture(GL_TEXTURE_2D, tex);
+            CHECK_GL();
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            CHECK_GL();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            CHECK_GL();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mLevels.size() - 1);
+            CHECK_GL();
+
+            for (i = 0; i < mLevels.size(); i++)
+            {
+                glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, mLevels[i].data());
+                CHECK_GL();
+
+                w = std::max(w / 2, 1);
+                h = std::max(h / 2, 1);
+            }
+        }
+};
+void PushRGBATexture(std::vector<uint8_t> &&rgba, const size_t width, const size_t height, const GLuint texture)
+{
+    if (GLEW_EXT_texture_compression_s3tc)
+    {
+        std::shared_ptr<CompressedImage> pCompressed(CompressRGBA(std::move(rgba), width, height, false));
+        App::Instance().PushGL(new FillCompressedGLTextureJob(pCompressed, texture));
+        return;
+    }
+
+    std::vector<std::vector<uint8_t>> levels;
+    size_t w = width, h = height, halfWidth, halfHeight;
+
+    levels.push_back(std::move(rgba));
+    while (w > 1 || h > 1)
+    {
+        halfWidth = std::max(w / 2, size_t(1));
+        halfHeight = std::max(h / 2, size_t(1));
+
+        levels.emplace_back();
+        HalveRGBA(levels[levels.size() - 2], w, h, levels.back(), halfWidth, halfHeight);
+
+        w = halfWidth;
+        h = halfHeight;
+    }
+
+    App::Instance().PushGL(new FillGLMipChainJob(std::move(levels), width, height, texture));
+}
+bool IsCacheUpToDate(const std::string &sourceLocation, const boost::filesystem::path &cachePath)
+{
+    boost::system::error_code ec;
+
+    if (!boost::filesystem::exists(cachePath, ec))
+        return false;
+
+    std::time_t sourceTime;
+    if (!App::Instance().GetResourceWriteTime(sourceLocation, sourceTime))
+        return false;
+
+    std::time_t cacheTime = boost::filesystem::last_write_time(cachePath, ec);
+    if (ec)
+        return false;
+
+    return cacheTime >= sourceTime;
+}
+// Failing to write the cache isn't fatal, the next launch just compresses again.
+void SaveToCache(const CompressedImage *pImage, const boost::filesystem::path &cachePath)
+{
+    boost::system::error_code ec;
+
+    // Write elsewhere first, so that a half written file is never picked up.
+    boost::filesystem::path tmpPath = cachePath;
+    tmpPath += ".tmp";
+
+    try
+    {
+        boost::filesystem::create_directories(cachePath.parent_path());
+
+        boost::filesystem::ofstream os(tmpPath, std::ios::binary);
+        if (!os.good())
+            throw IOError("cannot write %s", tmpPath.string().c_str());
+
+        WriteKTX(os, pImage);
+        os.close();
+
+        boost::filesystem::rename(tmpPath, cachePath);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "not caching " << cachePath.string() << ": " << e.what() << std::endl;
+        boost::filesystem::remove(tmpPath, ec);
+    }
+}
+// Allocates the texture's storage, for the row bands to fill.
+class AllocGLTextureJob: public Job
+{
+    private:
+        GLuint tex;
+        GLsizei width, height;
+    public:
+        AllocGLTextureJob(const GLuint texture, const GLsizei w, const GLsizei h)
+        : tex(texture), width(w), height(h)
+        {
+        }
+
+        void Run(void)
+        {
+            glBindTexture(GL_TEXTURE_2D, tex);
+            CHECK_GL();
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            CHECK_GL();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            CHECK_GL();
+
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            CHECK_GL();
+        }
+};
+
+// At most this many bands per texture wait for the GL thread, that bounds the memory use.
+#define MAX_TEXTURE_BANDS_IN_FLIGHT 4
+
+/**
+ *  Uploads rows, either from a staging slot or from memory.
+ *  The last band also makes the mipmaps.
+ */
+class FillGLTextureBandJob: public Job
+{
+    private:
+        GLuint tex;
+        GLint y;
+        GLsizei width, height;
+        GLenum format;
+        bool last;
+
+        size_t stagingSlot;
+        std::unique_ptr<png_byte[]> pPixels;  // NULL if staged
+
+        std::shared_ptr<std::atomic<size_t>> pCountInFlight;
+        bool ran;
+    public:
+        FillGLTextureBandJob(const GLuint texture, const GLint y0, const GLsizei w, const GLsizei h, const GLenum f,
+                             const bool l, const size_t slot, std::unique_ptr<png_byte[]> &&p,
+                             std::shared_ptr<std::atomic<size_t>> pCount)
+        : tex(texture), y(y0), width(w), height(h), format(f), last(l),
+          stagingSlot(slot), pPixels(std::move(p)), pCountInFlight(pCount), ran(false)
+        {
+        }
+
+        // Thrown away without running, the slot must still be given back.
+        ~FillGLTextureBandJob(void)
+        {
+            if (pPixels == NULL && !ran)
+                App::Instance().GetTextureStagingBuffer()->Release(stagingSlot);
+        }
+
+        size_t GetUploadSize(void) const
+        {
+            return size_t(width) * height * (format == GL_RGB ? 3 : 4);
+        }
+
+        void Run(void)
+        {
+            ran = true;
+
+            if (pPixels == NULL)
+                App::Instance().GetTextureStagingBuffer()->CopyToTexture(stagingSlot, tex, y, width, height, format);
+            else
+            {
+                glBindTexture(GL_TEXTURE_2D, tex);
+                CHECK_GL();
+
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                CHECK_GL();
+
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, height, format, GL_UNSIGNED_BYTE, pPixels.get());
+                CHECK_GL();
+
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                CHECK_GL();
+            }
+
+            (*pCountInFlight)--;
+
+            if (last)
+            {
+                glBindTexture(GL_TEXTURE_2D, tex);
+                CHECK_GL();
+
+                glGenerateMipmap(GL_TEXTURE_2D);
+                CHECK_GL();
+
+                // Until now, only level 0 was there to sample.
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                CHECK_GL();
+            }
+        }
+};
+/**
+ *  Decodes bands of rows, while the GL thread uploads the previous ones.
+ *  Returns false if the png can't be read row by row.
+ */
+bool StreamPNGTexture(std::shared_ptr<const Resource> pResource, const GLuint texture)
+{
+    PNGRowReader reader(pResource);
+    if (reader.IsInterlaced())
+        return false;
+
+    png_uint_32 width, height;
+    reader.GetDimensions(width, height);
+
+    GLenum format = reader.GetColorType() == PNG_COLOR_TYPE_RGB ? GL_RGB : GL_RGBA;
+    size_t rowBytes = reader.GetRowBytes();
+
+    StagingBuffer *pStaging = App::Instance().GetTextureStagingBuffer();
+    size_t bandSize = pStaging != NULL ? pStaging->GetSlotSize() : TEXTURE_STAGING_SLOT_SIZE;
+    png_uint_32 bandRows = std::max(bandSize / rowBytes, size_t(1)),
+                row = 0, countRows, i;
+
+    std::shared_ptr<std::atomic<size_t>> pCountInFlight = std::make_shared<std::atomic<size_t>>(0);
+
+    App::Instance().PushGL(new AllocGLTextureJob(texture, width, height));
+
+    while (row < height)
+    {
+        countRows = std::min(bandRows, height - row);
+
+        while (pCountInFlight->load() >= MAX_TEXTURE_BANDS_IN_FLIGHT)
+        {
+            // The GL thread isn't going to take any more.
+            if (!App::Instance().IsRunning())
+                return true;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        size_t slot = 0;
+        void *pStaged;
+        png_bytep pBand;
+        std::unique_ptr<png_byte[]> pPixels;
+        if (pStaging != NULL && countRows * rowBytes <= pStaging->GetSlotSize() && pStaging->Acquire(slot, pStaged))
+            pBand = (png_bytep)pStaged;
+        else
+        {
+            pPixels.reset(new png_byte[countRows * rowBytes]);
+            pBand = pPixels.get();
+        }
+
+        try
+        {
+            // The png's first row is at the top, the GL's first row at the bottom.
+            for (i = 0; i < countRows; i++)
+                reader.ReadRow(pBand + (countRows - i - 1) * rowBytes);
+
+            row += countRows;
+            if (row >= height)
+                reader.End();
+        }
+        catch (...)
+        {
+            if (pPixels == NULL)
+                pStaging->Release(slot);
+            throw;
+        }
+
+        (*pCountInFlight)++;
+        App::Instance().PushGL(new FillGLTextureBandJob(texture, height - row, width, countRows, format,
+                                                        row >= height, slot, std::move(pPixels), pCountInFlight));
+    }
+
+    return true;
+}
 PNGTextureLoadJob::PNGTextureLoadJob(const std::string &loc, const GLuint tex): location(loc), texture(tex)
 {
 }
 void PNGTextureLoadJob::Run(void)
 {
     static thread_local PNGReader reader;
-    boost::filesystem::ifstream is;
 
-    boost::filesystem::path path = App::Instance().GetResourcePath((boost::format("textures/%1%.png") % location).str());
-    is.open(path, std::ios::binary);
+    std::string pngLocation = (boost::format("textures/%1%.png") % location).str(),
+                cacheLocation = (boost::format("texturecache/%1%.ktx") % location).str();
+
+    bool compress = GLEW_EXT_texture_compression_s3tc;
+
+    if (compress && IsCacheUpToDate(pngLocation, App::Instance().GetResourcePath(cacheLocation)))
+    {
+        try
+        {
+            std::shared_ptr<CompressedImage> pCompressed(ReadKTX(App::Instance().OpenResource(cacheLocation)));
+            App::Instance().PushGL(new FillCompressedGLTextureJob(pCompressed, texture));
+            return;
+        }
+        catch (const Error &e)
+        {
+            std::cerr << "ignoring " << cacheLocation << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::shared_ptr<const Resource> pResource = App::Instance().OpenResource(pngLocation);
 
-    if (!is.good())
-        throw IOError("Error reading %s", path.string().c_str());
+    // Only interlaced pngs need to be decoded as a whole, the others are streamed.
+    if (compress)
+    {
+        std::shared_ptr<CompressedImage> pCompressed(StreamCompressPNG(pResource));
+        if (pCompressed == NULL)
+        {
+            std::shared_ptr<PNGImage> pImage(reader.ReadImage(*pResource), [&reader](PNGImage *p) { reader.FreeImage(p); });
+            pCompressed.reset(CompressImage(pImage.get()));
+        }
+        pResource.reset();
 
-    std::shared_ptr<PNGImage> pImage(reader.ReadImage(is), [&reader](PNGImage *p) { reader.FreeImage(p); });
+        SaveToCache(pCompressed.get(), App::Instance().GetResourcePath(cacheLocation));
 
-    is.close();
+        App::Instance().PushGL(new FillCompressedGLTextureJob(pCompressed, texture));
+    }
+    else if (!StreamPNGTexture(pResource, texture))
+    {
+        std::shared_ptr<PNGImage> pImage(reader.ReadImage(*pResource), [&reader](PNGImage *p) { reader.FreeImage(p); });
+        pResource.reset();
 
-    App::Instance().PushGL(new FillGLTextureJob(pImage, texture));
+        App::Instance().PushGL(new FillGLTextureJob(pImage, texture));
+    }
 }
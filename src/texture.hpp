@@ -3,6 +3,9 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -10,6 +13,7 @@
 
 #include "error.hpp"
 #include "load.hpp"
+#include "resource.hpp"
 
 class PNGError: public Error
 {
@@ -51,7 +55,7 @@ class PNGReader
         PNGReader(void);
         ~PNGReader(void);
 
-        PNGImage *ReadImage(std::istream &);
+        PNGImage *ReadImage(const Resource &);
         void FreeImage(PNGImage *);
 };
 
@@ -59,6 +63,105 @@ class PNGReader
 void FillGLTexture(const PNGImage *, GLuint texture);
 
 
+struct PNGReadCursor
+{
+    const char *pData;
+    size_t remaining;
+};
+
+/**
+ *  Decodes one png, a row at a time, so that the whole image never needs to be in memory.
+ *  Interlaced images can't be read like this.
+ */
+class PNGRowReader
+{
+    private:
+        std::shared_ptr<const Resource> pResource;
+        PNGReadCursor cursor;
+
+        png_struct *pPNG;
+        png_info *pInfo,
+                 *pEnd;
+
+        png_uint_32 width, height;
+        int colorType;
+        bool interlaced;
+
+        PNGRowReader(const PNGRowReader &) = delete;
+        void operator=(const PNGRowReader &) = delete;
+    public:
+        PNGRowReader(std::shared_ptr<const Resource>);  // reads the header
+        ~PNGRowReader(void);
+
+        void GetDimensions(png_uint_32 &w, png_uint_32 &h) const;
+        int GetColorType(void) const;  // Either PNG_COLOR_TYPE_RGB or PNG_COLOR_TYPE_RGB_ALPHA.
+        size_t GetRowBytes(void) const;
+        bool IsInterlaced(void) const;
+
+        void ReadRow(png_bytep row);
+        void End(void);
+};
+
+// Row bands of uncompressed textures go through these.
+#define TEXTURE_STAGING_SLOT_SIZE 262144
+#define COUNT_TEXTURE_STAGING_SLOTS 8
+
+
+struct CompressedMipLevel
+{
+    GLsizei width, height;
+    const uint8_t *pData;
+    size_t size;
+};
+
+/**
+ *  S3TC compressed, with all mip levels down to 1 x 1.
+ *  The levels point into either its own buffer, or a mapped file.
+ */
+class CompressedImage
+{
+    private:
+        GLenum internalFormat;
+        std::vector<CompressedMipLevel> mLevels;
+
+        std::vector<uint8_t> mBuffer;
+        std::shared_ptr<const Resource> pResource;
+    public:
+        GLenum GetInternalFormat(void) const;
+        size_t CountLevels(void) const;
+        const CompressedMipLevel &GetLevel(const size_t) const;
+        size_t GetSize(void) const;  // all levels, in bytes
+
+    friend CompressedImage *AllocCompressedImage(size_t, size_t, const bool);
+    friend void CompressMipLevels(CompressedImage *, std::vector<uint8_t> &&, const size_t);
+    friend CompressedImage *StreamCompressPNG(std::shared_ptr<const Resource>);
+    friend CompressedImage *ReadKTX(std::shared_ptr<const Resource>);
+};
+
+// DXT1 if the image has no alpha channel, DXT5 otherwise.
+CompressedImage *CompressImage(const PNGImage *);
+CompressedImage *CompressRGBA(std::vector<uint8_t> &&rgba, size_t width, size_t height, const bool alpha);
+
+// Like CompressImage, but decodes and compresses a row of blocks at a time. NULL if the png is interlaced.
+CompressedImage *StreamCompressPNG(std::shared_ptr<const Resource>);
+
+// KTX 1.1 containers, throw FormatError or IOError. Reading doesn't copy the data.
+CompressedImage *ReadKTX(std::shared_ptr<const Resource>);
+void WriteKTX(std::ostream &, const CompressedImage *);
+
+
+/**
+ *  For textures that are made at runtime. Makes all mip levels,
+ *  compresses them if S3TC is supported and pushes the upload to the GL thread. Any thread.
+ *  The alpha channel is dropped.
+ */
+void PushRGBATexture(std::vector<uint8_t> &&rgba, const size_t width, const size_t height, const GLuint texture);
+
+/**
+ *  Uses the compressed copy in the texture cache, if it's not older than the png.
+ *  Otherwise, it makes that copy first. Without S3TC support, the png is uploaded as is.
+ *  Either way, the png is decoded a band of rows at a time, unless it's interlaced.
+ */
 class PNGTextureLoadJob: public Job
 {
     private:
@@ -5,6 +5,7 @@
 #include "error.hpp"
 #include "shader.hpp"
 #include "app.hpp"
+#include "frame.hpp"
 
 
 const std::string srcWaveFunc = (boost::format(R"shader(
@@ -25,14 +26,9 @@ typedef unsigned int WaterIndex;
 #define WATERVERTEX_POSITION_INDEX 0
 
 
-const std::string waterVertexShaderSrc = "#version 150" +
+const std::string waterVertexShaderSrc = "#version 150\n" FRAME_UNIFORM_BLOCK_GLSL +
 srcWaveFunc +
 R"shader(
-uniform float time;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
-uniform vec3 center;
-
 in vec2 position;
 
 out VertexData
@@ -70,11 +66,7 @@ void main()
 }
 )shader",
 
-waterFragmentShaderSrc = R"shader(
-#version 150
-
-uniform vec3 lightDirection;
-
+waterFragmentShaderSrc = "#version 150\n" FRAME_UNIFORM_BLOCK_GLSL R"shader(
 in VertexData
 {
     vec3 position,
@@ -148,15 +140,15 @@ struct Water2DGrid
 };
 void WaterRenderer::FillBuffers(const size_t distanceSquares)
 {
+    GLState *pState = App::Instance().GetGLState();
+
     Water2DGrid grid(distanceSquares);
 
-    glBindBuffer(GL_ARRAY_BUFFER, *pVertexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pVertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, grid.countVertices * sizeof(WaterVertex), grid.mVertices, GL_STATIC_DRAW);
     CHECK_GL();
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pIndexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pIndexBuffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, grid.countIndices * sizeof(WaterIndex), grid.mIndices, GL_STATIC_DRAW);
     CHECK_GL();
 
@@ -164,10 +156,12 @@ void WaterRenderer::FillBuffers(const size_t distanceSquares)
 }
 void WaterRenderer::TellInit(Queue &)
 {
-    pProgram = App::Instance().GetGLManager()->AllocShaderProgram();
+    mProgram.Alloc();
     VertexAttributeMap attributes;
     attributes["position"] = WATERVERTEX_POSITION_INDEX;
-    App::Instance().PushGL(new ShaderLoadJob(*pProgram, waterVertexShaderSrc, waterFragmentShaderSrc, attributes));
+    UniformBlockBindingMap blocks;
+    blocks[FRAME_UNIFORM_BLOCK_NAME] = FRAME_UNIFORMS_BINDING;
+    App::Instance().PushGL(new ShaderLoadJob(mProgram, waterVertexShaderSrc, waterFragmentShaderSrc, attributes, blocks));
 
     Config config;
     App::Instance().GetConfig(config);
@@ -176,58 +170,19 @@ void WaterRenderer::TellInit(Queue &)
     pIndexBuffer = App::Instance().GetGLManager()->AllocBuffer();
     FillBuffers((size_t)config.render.distance);
 }
-void WaterRenderer::Render(const mat4 &projection, const mat4 &view, const vec3 &center, const vec3 &lightDirection, const float time)
+void WaterRenderer::Render(void)
 {
-    glEnable(GL_DEPTH_TEST);
-    CHECK_GL();
-
-    glDisable(GL_CULL_FACE);
-    CHECK_GL();
-
-    glUseProgram(*pProgram);
-    CHECK_GL();
-
-    GLint projectionMatrixLocation,
-          viewMatrixLocation,
-          lightDirectionLocation,
-          centerLocation,
-          timeLocation;
-
-    projectionMatrixLocation = glGetUniformLocation(*pProgram, "projectionMatrix");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(projectionMatrixLocation);
-    glUniformMatrix4fv(projectionMatrixLocation, 1, GL_FALSE, value_ptr(projection));
-    CHECK_GL();
+    GLState *pState = App::Instance().GetGLState();
 
-    viewMatrixLocation = glGetUniformLocation(*pProgram, "viewMatrix");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(viewMatrixLocation);
-    glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, value_ptr(view));
-    CHECK_GL();
+    pState->Enable(GL_DEPTH_TEST);
 
-    lightDirectionLocation = glGetUniformLocation(*pProgram, "lightDirection");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(lightDirectionLocation);
-    glUniform3fv(lightDirectionLocation, 1, value_ptr(lightDirection));
-    CHECK_GL();
+    pState->Disable(GL_CULL_FACE);
 
-    centerLocation = glGetUniformLocation(*pProgram, "center");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(centerLocation);
-    glUniform3fv(centerLocation, 1, value_ptr(center));
-    CHECK_GL();
-
-    timeLocation = glGetUniformLocation(*pProgram, "time");
-    CHECK_GL();
-    CHECK_UNIFORM_LOCATION(timeLocation);
-    glUniform1f(timeLocation, time);
-    CHECK_GL();
+    mProgram.Use();
 
-    glBindBuffer(GL_ARRAY_BUFFER, *pVertexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ARRAY_BUFFER, *pVertexBuffer);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pIndexBuffer);
-    CHECK_GL();
+    pState->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, *pIndexBuffer);
 
     glEnableVertexAttribArray(WATERVERTEX_POSITION_INDEX);
     CHECK_GL();
@@ -19,15 +19,16 @@ extern const std::string srcWaveFunc;
 class WaterRenderer: public Initializable
 {
     private:
-        GLRef pProgram,
-              pVertexBuffer, pIndexBuffer;
+        ShaderProgram mProgram;
+        GLRef pVertexBuffer, pIndexBuffer;
         size_t countIndices;
 
         void FillBuffers(const size_t distanceSquares);
     public:
         void TellInit(Queue &);
 
-        void Render(const mat4 &projection, const mat4 &view, const vec3 &center, const vec3 &lightDirection, const float time);
+        // Uses the frame uniforms.
+        void Render(void);
 };
 
 #endif  // WATER_HPP